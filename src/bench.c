@@ -0,0 +1,306 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "ksw2/kseq.h"
+#include "ksw2/ksw2.h"
+#include "parasail/parasail.h"
+#include "fastx.h"
+#include "main.h"
+#include "bench.h"
+
+// the parasail vectorization strategies (see parasail_to_func_name)
+static const char *bench_vec_strat_names[] = { "striped", "scan", "diag" };
+#define BENCH_N_VEC_STRATS 3
+
+typedef struct {
+	int n_pairs;
+	int length;
+	double divergence;
+	double indel_rate;
+	uint64_t seed;
+	int library; // -1 for all
+	int alignment_mode; // -1 for all
+	const char *query_fn;
+	const char *target_fn;
+} bench_opt_t;
+
+typedef struct {
+	int n, m;
+	char **queries;
+	char **targets;
+	int64_t n_cells; // the sum of the query length times the target length
+} bench_pairs_t;
+
+/*****************/
+/* bench_pairs_t */
+/*****************/
+
+// splitmix64, so that the workload is the same for a given seed on every platform
+static inline uint64_t bench_rand(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// a uniform random number in [0, 1)
+static inline double bench_drand(uint64_t *x)
+{
+	return (bench_rand(x) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void bench_pairs_add(bench_pairs_t *pairs, char *query, char *target)
+{
+	if (pairs->n == pairs->m) {
+		pairs->m = pairs->m ? pairs->m<<1 : 1024;
+		pairs->queries = realloc(pairs->queries, pairs->m * sizeof(char*));
+		pairs->targets = realloc(pairs->targets, pairs->m * sizeof(char*));
+	}
+	pairs->queries[pairs->n] = query;
+	pairs->targets[pairs->n] = target;
+	pairs->n_cells += (int64_t)strlen(query) * strlen(target);
+	pairs->n++;
+}
+
+// Generates random queries, and targets that differ from the query by the given rate of substitutions and indels.
+// Insertions and deletions are equally likely and are each one base long.
+static void bench_pairs_simulate(bench_pairs_t *pairs, const bench_opt_t *bopt)
+{
+	static const char bases[4] = { 'A', 'C', 'G', 'T' };
+	uint64_t x = bopt->seed;
+	int i, j, k;
+	for (i = 0; i < bopt->n_pairs; ++i) {
+		char *query = malloc(bopt->length + 1);
+		char *target = malloc(2 * bopt->length + 1); // at most one insertion per base
+		for (j = 0; j < bopt->length; ++j) query[j] = bases[bench_rand(&x) & 3];
+		query[bopt->length] = '\0';
+		for (j = k = 0; j < bopt->length; ++j) {
+			double r = bench_drand(&x);
+			if (r < bopt->indel_rate) {
+				if (r < bopt->indel_rate / 2) { // insertion, then the base
+					target[k++] = bases[bench_rand(&x) & 3];
+					target[k++] = query[j];
+				}
+				// otherwise a deletion, so skip the base
+			}
+			else if (bench_drand(&x) < bopt->divergence) { // substitution with a different base
+				char base;
+				do { base = bases[bench_rand(&x) & 3]; } while (base == query[j]);
+				target[k++] = base;
+			}
+			else target[k++] = query[j];
+		}
+		target[k] = '\0';
+		bench_pairs_add(pairs, query, target);
+	}
+}
+
+static void bench_pairs_read(bench_pairs_t *pairs, const bench_opt_t *bopt)
+{
+	kstring_t query_name = {0, 0, 0}, query = {0, 0, 0}, target_name = {0, 0, 0}, target = {0, 0, 0};
+	fastx_reader_t *r = fastx_reader_init(bopt->query_fn, bopt->target_fn);
+	while (fastx_reader_next(r, &query_name, &query, &target_name, &target)) {
+		bench_pairs_add(pairs, strdup(query.s), strdup(target.s));
+	}
+	fastx_reader_destroy(r);
+	free(query_name.s);
+	free(query.s);
+	free(target_name.s);
+	free(target.s);
+	assert_or_exit(pairs->n > 0, "No pairs found in '%s'.", bopt->query_fn);
+}
+
+static void bench_pairs_destroy(bench_pairs_t *pairs)
+{
+	int i;
+	for (i = 0; i < pairs->n; ++i) {
+		free(pairs->queries[i]);
+		free(pairs->targets[i]);
+	}
+	free(pairs->queries);
+	free(pairs->targets);
+}
+
+/*********/
+/* bench */
+/*********/
+
+static inline double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench_cmp_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Returns non-zero if the library supports the alignment mode, as in main_opt_validate
+static int bench_is_valid(int library, int alignment_mode)
+{
+	switch (library) {
+		case Ksw2: return alignment_mode == Extension || alignment_mode == Global;
+		case Parasail: return alignment_mode == Local || alignment_mode == Glocal || alignment_mode == Global;
+		default: return 0;
+	}
+}
+
+// Aligns every pair once with the given settings and writes one row of statistics
+static void bench_run(FILE *fp, bench_pairs_t *pairs, int library, int alignment_mode, int vec_strat, int add_cigar, double *latencies)
+{
+	int i;
+	double total = 0.0;
+	struct rusage usage;
+	main_opt_t *opt = main_opt_init();
+	alignment_t *alignment = alignment_init();
+
+	opt->library = library;
+	opt->alignment_mode = alignment_mode;
+	opt->parasail_vec_strat = vec_strat;
+	opt->add_cigar = add_cigar;
+	main_opt_validate(opt);
+	main_opt_init_library(opt);
+
+	for (i = 0; i < pairs->n; ++i) {
+		double start = bench_now();
+		align_pair(pairs->queries[i], strlen(pairs->queries[i]), pairs->targets[i], strlen(pairs->targets[i]), opt, opt->_library_data, alignment);
+		latencies[i] = bench_now() - start;
+		total += latencies[i];
+	}
+	qsort(latencies, pairs->n, sizeof(double), bench_cmp_double);
+	getrusage(RUSAGE_SELF, &usage);
+
+	fprintf(fp, "%s\t%s\t%s\t%s\t%d\t%.3f\t%.0f\t%.3f\t%.2f\t%.2f\t%.1f\n",
+			library_to_str(library),
+			alignment_mode_to_str(alignment_mode),
+			library == Parasail ? bench_vec_strat_names[vec_strat] : "-",
+			add_cigar ? "true" : "false",
+			pairs->n,
+			total,
+			pairs->n / total,
+			pairs->n_cells / total * 1e-9,
+			latencies[pairs->n / 2] * 1e6,
+			latencies[(int)(pairs->n * 0.99)] * 1e6,
+			usage.ru_maxrss / 1024.0); // kilobytes on Linux
+	fflush(fp);
+
+	alignment_destroy(alignment);
+	main_opt_destroy(opt);
+}
+
+static void bench_usage(const bench_opt_t *bopt)
+{
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: ksw bench [options] [<in.fq> [<in2.fq>]]\n\n");
+	fprintf(stderr, "Aligns each pair with every valid combination of library, alignment mode, vectorization strategy\n");
+	fprintf(stderr, "(parasail only), and whether the cigar is output, then writes the throughput and latency of each.\n");
+	fprintf(stderr, "Pairs are simulated unless FASTA/FASTQ files are given, as for ksw.  The peak RSS is for the whole\n");
+	fprintf(stderr, "process so far, so it never decreases from one row to the next.\n\n");
+	fprintf(stderr, "Options:\n\n");
+	fprintf(stderr, "       -N INT      The number of pairs to simulate [%d]\n", bopt->n_pairs);
+	fprintf(stderr, "       -L INT      The length of the simulated queries [%d]\n", bopt->length);
+	fprintf(stderr, "       -d FLOAT    The substitution rate of the simulated targets [%.3f]\n", bopt->divergence);
+	fprintf(stderr, "       -i FLOAT    The indel rate of the simulated targets [%.3f]\n", bopt->indel_rate);
+	fprintf(stderr, "       -s INT      The random seed [%llu]\n", (unsigned long long)bopt->seed);
+	fprintf(stderr, "       -l INT      Only benchmark this library (1 - ksw2, 2 - parasail), otherwise all [%d]\n", bopt->library);
+	fprintf(stderr, "       -M INT      Only benchmark this alignment mode (see ksw -h), otherwise all [%d]\n", bopt->alignment_mode);
+}
+
+int main_bench(int argc, char *argv[])
+{
+	int c, library, alignment_mode, vec_strat, add_cigar;
+	bench_opt_t bopt;
+	bench_pairs_t pairs;
+	double *latencies;
+
+	memset(&bopt, 0, sizeof(bench_opt_t));
+	memset(&pairs, 0, sizeof(bench_pairs_t));
+	bopt.n_pairs = 10000;
+	bopt.length = 150;
+	bopt.divergence = 0.05;
+	bopt.indel_rate = 0.01;
+	bopt.seed = 11;
+	bopt.library = -1;
+	bopt.alignment_mode = -1;
+
+	while ((c = getopt(argc, argv, "N:L:d:i:s:l:M:h")) >= 0) {
+		switch (c) {
+			case 'N': bopt.n_pairs = atoi(optarg); break;
+			case 'L': bopt.length = atoi(optarg); break;
+			case 'd': bopt.divergence = atof(optarg); break;
+			case 'i': bopt.indel_rate = atof(optarg); break;
+			case 's': bopt.seed = strtoull(optarg, NULL, 10); break;
+			case 'l': bopt.library = atoi(optarg); break;
+			case 'M': bopt.alignment_mode = atoi(optarg); break;
+			case 'h': bench_usage(&bopt); return 1;
+			default: bench_usage(&bopt); return 1;
+		}
+	}
+	if (optind + 2 < argc) {
+		bench_usage(&bopt);
+		return 1;
+	}
+	if (optind < argc) bopt.query_fn = argv[optind];
+	if (optind + 1 < argc) bopt.target_fn = argv[optind + 1];
+
+	assert_or_exit(bopt.n_pairs > 0, "Number of pairs (-N) must be greater than zero, found %d.", bopt.n_pairs);
+	assert_or_exit(bopt.length > 0, "Query length (-L) must be greater than zero, found %d.", bopt.length);
+	assert_or_exit(0 <= bopt.divergence && bopt.divergence <= 1, "Substitution rate (-d) must be between zero and one, found %f.", bopt.divergence);
+	assert_or_exit(0 <= bopt.indel_rate && bopt.indel_rate <= 1, "Indel rate (-i) must be between zero and one, found %f.", bopt.indel_rate);
+	assert_or_exit(bopt.library == -1 || bopt.library == Ksw2 || bopt.library == Parasail, "Library (-l) must be %d or %d, found %d.", Ksw2, Parasail, bopt.library);
+	assert_or_exit(bopt.alignment_mode == -1 || (AlignmentModeStart <= bopt.alignment_mode && bopt.alignment_mode <= AlignmentModeEnd), "Alignment mode (-M) was not valid ([%d-%d]), found %d.", AlignmentModeStart, AlignmentModeEnd, bopt.alignment_mode);
+
+	if (bopt.query_fn != NULL) bench_pairs_read(&pairs, &bopt);
+	else bench_pairs_simulate(&pairs, &bopt);
+	latencies = malloc(pairs.n * sizeof(double));
+
+	fprintf(stdout, "library\tmode\tvec_strategy\tcigar\tpairs\tseconds\talignments_per_sec\tgcups\tp50_us\tp99_us\tpeak_rss_mb\n");
+	for (library = Ksw2; library <= Parasail; ++library) {
+		if (bopt.library != -1 && bopt.library != library) continue;
+		for (alignment_mode = AlignmentModeStart; alignment_mode <= AlignmentModeEnd; ++alignment_mode) {
+			if (bopt.alignment_mode != -1 && bopt.alignment_mode != alignment_mode) continue;
+			if (!bench_is_valid(library, alignment_mode)) continue;
+			for (vec_strat = 0; vec_strat < (library == Parasail ? BENCH_N_VEC_STRATS : 1); ++vec_strat) {
+				for (add_cigar = 0; add_cigar <= 1; ++add_cigar) {
+					bench_run(stdout, &pairs, library, alignment_mode, vec_strat, add_cigar, latencies);
+				}
+			}
+		}
+	}
+
+	free(latencies);
+	bench_pairs_destroy(&pairs);
+	return 0;
+}
@@ -0,0 +1,7 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+// Runs the benchmark (`ksw bench`), where argv[0] is "bench".  Returns the exit code.
+int main_bench(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,300 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "ksw2/kseq.h"
+#include "ksw2/ksw2.h"
+#include "parasail/parasail.h"
+#include "kthread.h"
+#include "main.h"
+#include "binary.h"
+#include "stats.h"
+
+#define BINARY_READ_SIZE     (1<<20)
+#define BINARY_HEADER_SIZE   20 // request_id, flags, query_length, target_length
+#define BINARY_PARAMS_SIZE   16
+#define BINARY_RECORD_SIZE   36 // request_id through n_cigar
+
+/******************/
+/* frame_reader_t */
+/******************/
+
+typedef struct {
+	int fd;
+	FILE *out; // flushed before blocking on a read
+	uint8_t *buf;
+	size_t begin, end, m;
+	int is_eof;
+} frame_reader_t;
+
+// Makes sure at least n bytes are buffered, reading if necessary.  Returns 0 if the input ended first.
+static int frame_reader_fill(frame_reader_t *r, size_t n)
+{
+	while (r->end - r->begin < n) {
+		ssize_t n_read;
+		if (r->is_eof) return 0;
+		// make room
+		if (r->begin > 0) {
+			memmove(r->buf, r->buf + r->begin, r->end - r->begin);
+			r->end -= r->begin;
+			r->begin = 0;
+		}
+		if (r->m < r->end + BINARY_READ_SIZE || r->m < n) {
+			r->m = (r->end + BINARY_READ_SIZE > n) ? r->end + BINARY_READ_SIZE : n;
+			r->buf = (uint8_t*)realloc(r->buf, r->m);
+		}
+		// no more input is buffered, so do not keep the caller waiting on any output
+		fflush(r->out);
+		n_read = read(r->fd, r->buf + r->end, r->m - r->end);
+		if (n_read < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "Error: could not read input: %s\n", strerror(errno));
+			exit(1);
+		}
+		if (n_read == 0) r->is_eof = 1;
+		r->end += n_read;
+	}
+	return 1;
+}
+
+static inline uint32_t read_u32(const uint8_t *p) { uint32_t x; memcpy(&x, p, 4); return x; }
+static inline uint64_t read_u64(const uint8_t *p) { uint64_t x; memcpy(&x, p, 8); return x; }
+
+/*******************/
+/* binary_frame_t  */
+/*******************/
+
+static inline void kstring_set(kstring_t *s, const uint8_t *src, int len)
+{
+	if (s->m < (size_t)len + 1) {
+		s->m = len + 1;
+		s->s = (char*)realloc(s->s, s->m);
+	}
+	memcpy(s->s, src, len);
+	s->s[len] = '\0';
+	s->l = len;
+}
+
+static inline int binary_params_are_valid(const int32_t *params)
+{
+	return params[0] >= 0 && params[1] > 0 && params[2] >= AutoBandWidth;
+}
+
+long binary_frame_parse(const uint8_t *buf, size_t n, binary_params_t *defaults, binary_frame_t *f, char *err)
+{
+	uint32_t length, flags, query_length, target_length;
+	uint64_t expected;
+	const uint8_t *p;
+
+	if (n < 4) return 0;
+	length = read_u32(buf);
+	// reject a frame that is too long before it is buffered
+	check_or_return(err, length <= BINARY_MAX_FRAME_LENGTH, "frame of %u bytes is longer than the maximum of %u bytes", length, (uint32_t)BINARY_MAX_FRAME_LENGTH);
+	if (n < 4 + (size_t)length) return 0;
+	check_or_return(err, length >= BINARY_HEADER_SIZE, "truncated frame (length %u) in the input", length);
+	p = buf + 4;
+	f->request_id    = read_u64(p);
+	flags            = read_u32(p + 8);
+	query_length     = read_u32(p + 12);
+	target_length    = read_u32(p + 16);
+	f->has_params    = (flags & BinaryFrameHasParams) != 0;
+	f->set_params    = (flags & BinaryFrameSetParams) != 0;
+	f->status        = BinaryStatusOk;
+	p += BINARY_HEADER_SIZE;
+
+	// summed in 64 bits so the lengths cannot wrap around, and as the frame is at most BINARY_MAX_FRAME_LENGTH bytes, each
+	// length then fits in an int
+	expected = (uint64_t)BINARY_HEADER_SIZE + (f->has_params ? BINARY_PARAMS_SIZE : 0) + query_length + target_length;
+	check_or_return(err, expected == length, "frame for request %llu has length %u but expected %llu", (unsigned long long)f->request_id, length, (unsigned long long)expected);
+	f->query_length  = (int)query_length;
+	f->target_length = (int)target_length;
+	check_or_return(err, !f->set_params || (f->has_params && f->query_length == 0 && f->target_length == 0),
+			"frame for request %llu sets the params, so must have params and no sequences", (unsigned long long)f->request_id);
+	if (f->has_params) {
+		memcpy(f->params, p, BINARY_PARAMS_SIZE);
+		p += BINARY_PARAMS_SIZE;
+		if (!binary_params_are_valid(f->params)) f->status = BinaryStatusInvalidParams;
+	}
+	if (f->set_params) { // for the later frames without their own params
+		if (f->status == BinaryStatusOk) {
+			defaults->has_params = 1;
+			memcpy(defaults->params, f->params, BINARY_PARAMS_SIZE);
+		}
+	}
+	else if (!f->has_params && defaults->has_params) {
+		f->has_params = 1;
+		memcpy(f->params, defaults->params, BINARY_PARAMS_SIZE);
+	}
+	// copy, as the input buffer is moved or re-used while reading the later frames of a batch, and NUL-terminate, as for
+	// the sequences read from text
+	kstring_set(&f->query, p, f->query_length);
+	kstring_set(&f->target, p + f->query_length, f->target_length);
+	return 4 + (long)length;
+}
+
+// Parses the next frame.  If block is zero, only a frame that is already fully buffered is parsed.  Returns 1 if a frame
+// was parsed, 0 otherwise.
+static int frame_reader_next(frame_reader_t *r, binary_params_t *defaults, binary_frame_t *f, int block)
+{
+	char err[KSW_ERR_LEN];
+	long n;
+	STATS_START(stats_start);
+
+	if (!block && (r->end - r->begin < 4 || r->end - r->begin < 4 + (size_t)read_u32(r->buf + r->begin))) return 0;
+	if (!frame_reader_fill(r, 4)) {
+		if (r->end != r->begin) {
+			fprintf(stderr, "Error: truncated frame at the end of the input\n");
+			exit(1);
+		}
+		return 0;
+	}
+	assert_or_exit(read_u32(r->buf + r->begin) <= BINARY_MAX_FRAME_LENGTH, "frame of %u bytes is longer than the maximum of %u bytes",
+			read_u32(r->buf + r->begin), (uint32_t)BINARY_MAX_FRAME_LENGTH);
+	if (!frame_reader_fill(r, 4 + (size_t)read_u32(r->buf + r->begin))) {
+		fprintf(stderr, "Error: truncated frame (length %u) in the input\n", read_u32(r->buf + r->begin));
+		exit(1);
+	}
+	n = binary_frame_parse(r->buf + r->begin, r->end - r->begin, defaults, f, err);
+	assert_or_exit(n > 0, "%s", err);
+	r->begin += n;
+	STATS_STAGE(StatsParse, stats_start);
+	return 1;
+}
+
+void binary_frame_align(const main_opt_t *opt, void *library_data, binary_frame_t *f)
+{
+	main_opt_t pair_opt;
+
+	alignment_reset(&f->alignment);
+	if (f->status != BinaryStatusOk || f->set_params) return;
+	if (f->has_params) { // override the gap penalties, band width, and z-drop for this pair only
+		pair_opt = *opt;
+		pair_opt.gap_open   = f->params[0];
+		pair_opt.gap_extend = f->params[1];
+		pair_opt.band_width = f->params[2];
+		pair_opt.zdrop      = f->params[3];
+		opt = &pair_opt;
+	}
+	align_pair(f->query.s, f->query_length, f->target.s, f->target_length, (main_opt_t*)opt, library_data, &f->alignment);
+}
+
+void binary_record_append(kstring_t *s, const main_opt_t *opt, const binary_frame_t *f)
+{
+	const alignment_t *a = &f->alignment;
+	int ok = (f->status == BinaryStatusOk && !f->set_params);
+	uint32_t n_cigar = (ok && opt->add_cigar == 1) ? a->n_cigar : 0;
+	uint32_t length = BINARY_RECORD_SIZE + n_cigar * sizeof(uint32_t);
+	int32_t values[5] = { 0, 0, 0, 0, 0 };
+	uint8_t *p;
+
+	if (ok) {
+		values[0] = a->score;
+		values[1] = a->qlb; values[2] = a->qle;
+		values[3] = a->tlb; values[4] = a->tle;
+	}
+	if (s->m < s->l + 4 + length) {
+		s->m = s->l + 4 + length;
+		kroundup32(s->m);
+		s->s = (char*)realloc(s->s, s->m);
+	}
+	p = (uint8_t*)s->s + s->l;
+	memcpy(p, &length, 4);
+	memcpy(p + 4, &f->request_id, 8);
+	memcpy(p + 12, &f->status, 4);
+	memcpy(p + 16, values, 5 * sizeof(int32_t));
+	memcpy(p + 36, &n_cigar, 4);
+	if (n_cigar > 0) memcpy(p + 40, a->cigar, n_cigar * sizeof(uint32_t));
+	s->l += 4 + length;
+}
+
+void binary_frame_destroy(binary_frame_t *f)
+{
+	free(f->query.s);
+	free(f->target.s);
+	free(f->alignment.cigar);
+}
+
+/********************/
+/* align_binary()   */
+/********************/
+
+typedef struct {
+	main_opt_t *opt;
+	void **library_data;
+	binary_frame_t *frames;
+} binary_batch_t;
+
+static void binary_align_worker(void *data, long i, int tid)
+{
+	binary_batch_t *b = (binary_batch_t*)data;
+	binary_frame_align(b->opt, b->library_data[tid], &b->frames[i]);
+}
+
+void align_binary(int in_fd, FILE *out, main_opt_t *opt, void **library_data)
+{
+	int i, n, m = 0;
+	frame_reader_t r;
+	binary_params_t defaults;
+	binary_batch_t b;
+	kstring_t records = {0, 0, NULL};
+
+	memset(&r, 0, sizeof(frame_reader_t));
+	memset(&defaults, 0, sizeof(binary_params_t));
+	r.fd = in_fd;
+	r.out = out;
+	b.opt = opt;
+	b.library_data = library_data;
+	b.frames = NULL;
+
+	for (;;) {
+		// wait for one frame, then take any others that have already arrived, so pipelined requests are aligned together
+		n = 0;
+		do {
+			if (n == m) {
+				m = m ? m<<1 : 64;
+				b.frames = (binary_frame_t*)realloc(b.frames, m * sizeof(binary_frame_t));
+				memset(b.frames + n, 0, (m - n) * sizeof(binary_frame_t));
+			}
+			if (!frame_reader_next(&r, &defaults, &b.frames[n], n == 0)) break;
+			n++;
+		} while (n < opt->batch_size);
+		if (n == 0) break;
+
+		kt_for(opt->n_threads, binary_align_worker, &b, n);
+		records.l = 0;
+		for (i = 0; i < n; ++i) binary_record_append(&records, opt, &b.frames[i]);
+		fwrite(records.s, 1, records.l, out);
+	}
+	fflush(out);
+
+	for (i = 0; i < m; ++i) binary_frame_destroy(&b.frames[i]);
+	free(b.frames);
+	free(records.s);
+	free(r.buf);
+}
@@ -0,0 +1,83 @@
+#ifndef __BINARY_H
+#define __BINARY_H
+
+/* A binary framed protocol (-B) for use by language bindings, as an alternative to newline-separated sequences in and
+ * tab-separated text out.  All integers are little-endian.
+ *
+ * Each input frame is:
+ *   uint32_t length;         // the number of bytes in the frame after this field
+ *   uint64_t request_id;     // echoed back in the output record
+ *   uint32_t flags;          // see BinaryFrameFlag
+ *   uint32_t query_length;
+ *   uint32_t target_length;
+ *   int32_t  params[4];      // only if BinaryFrameHasParams: gap open, gap extend, band width (-1 for automatic), and z-drop for this pair
+ *   char     query[query_length];
+ *   char     target[target_length];
+ *
+ * Each output record is:
+ *   uint32_t length;         // the number of bytes in the record after this field
+ *   uint64_t request_id;
+ *   int32_t  status;         // see BinaryStatus; the remaining fields are zero unless BinaryStatusOk
+ *   int32_t  score;
+ *   int32_t  query_start, query_end, target_start, target_end; // zero-based and inclusive
+ *   uint32_t n_cigar;        // zero unless the cigar is requested (-c)
+ *   uint32_t cigar[n_cigar]; // length<<4 | op, where op is 0 (M), 1 (I), or 2 (D)
+ *
+ * A frame with BinaryFrameSetParams (and BinaryFrameHasParams, but no query or target) sets the params for the later
+ * frames in the same input, or on the same connection with --listen, that do not have their own.  Its record has no
+ * alignment, and its status is BinaryStatusInvalidParams if the params are invalid, in which case they are not set.
+ *
+ * A frame longer than BINARY_MAX_FRAME_LENGTH bytes (after the length field) is malformed, and is rejected as soon as
+ * its length is read, before it is buffered.
+ *
+ * Many frames may be sent before reading any records.  Records are written in the order the frames were received, and
+ * the output is only flushed when no more input is buffered.
+ */
+
+#define BINARY_MAX_FRAME_LENGTH (64<<20)
+
+enum BinaryFrameFlag {
+	BinaryFrameHasParams = 1,
+	BinaryFrameSetParams = 2,
+};
+
+enum BinaryStatus {
+	BinaryStatusOk            = 0,
+	BinaryStatusInvalidParams = 1,
+};
+
+// The params set by BinaryFrameSetParams, for one input or connection
+typedef struct {
+	int32_t has_params;
+	int32_t params[4];
+} binary_params_t;
+
+typedef struct {
+	uint64_t request_id;
+	int32_t status;
+	int32_t has_params;
+	int32_t set_params;
+	int32_t params[4];
+	int query_length, target_length;
+	kstring_t query, target;
+	alignment_t alignment;
+} binary_frame_t;
+
+// Parses the frame at the start of buf, which holds n bytes, into f (zero-initialized, or re-used), applying or
+// updating the defaults.  Returns the number of bytes in the frame, 0 if it is not fully buffered, or -1 if it is
+// malformed, with the message in err.  A frame that is too long is malformed once its length is buffered.
+long binary_frame_parse(const uint8_t *buf, size_t n, binary_params_t *defaults, binary_frame_t *f, char *err);
+
+// Aligns the pair in a parsed frame, unless its params are invalid or it only sets the params
+void binary_frame_align(const main_opt_t *opt, void *library_data, binary_frame_t *f);
+
+// Appends the output record for an aligned frame
+void binary_record_append(kstring_t *s, const main_opt_t *opt, const binary_frame_t *f);
+
+void binary_frame_destroy(binary_frame_t *f);
+
+// Reads frames from in_fd until end of input, aligning and writing a record for each to out.  The library data is
+// per-thread (opt->n_threads).
+void align_binary(int in_fd, FILE *out, main_opt_t *opt, void **library_data);
+
+#endif
@@ -0,0 +1,441 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ksw2/ksw2.h"
+#include "parasail/parasail.h"
+#include "main.h"
+#include "cache.h"
+
+#define CACHE_N_SHARDS 16 // a power of two
+#define CACHE_MIN_BUCKETS 64
+#define CACHE_FILE_MAGIC "KSWCACHE"
+#define CACHE_FILE_VERSION 1
+
+typedef struct cache_entry_t {
+	struct cache_entry_t *chain; // the next entry in the same bucket
+	struct cache_entry_t *prev, *next; // the least recently used list, most recent first
+	uint64_t key;
+	uint64_t scheme;
+	size_t size; // the bytes used, including the entry itself
+	int query_length, target_length;
+	int score, qlb, tlb, qle, tle, n_cigar;
+	uint32_t data[]; // the cigar, then the query and target
+} cache_entry_t;
+
+typedef struct {
+	pthread_mutex_t mutex;
+	cache_entry_t **buckets;
+	size_t n_buckets, n_entries;
+	cache_entry_t *head, *tail; // the most and least recently used
+	size_t size, max_size; // the bytes used by the entries and buckets
+	uint64_t n_hits, n_misses;
+} cache_shard_t;
+
+struct result_cache_t {
+	cache_shard_t shards[CACHE_N_SHARDS];
+	size_t max_size;
+};
+
+// A saved entry, followed by the cigar, query, and target
+typedef struct {
+	uint64_t scheme;
+	int32_t query_length, target_length;
+	int32_t score, qlb, tlb, qle, tle, n_cigar;
+} cache_record_t;
+
+/***********/
+/* hashing */
+/***********/
+
+#define HASH_MULTIPLIER 0x9e3779b97f4a7c15ULL
+
+// Finalizes the hash so every input bit changes every output bit (the MurmurHash3 finalizer)
+static inline uint64_t hash_finalize(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// Hashes eight bytes at a time, then the rest and the length, so sequences of different lengths differ
+static uint64_t hash_bytes(uint64_t h, const char *s, int n)
+{
+	uint64_t x;
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		memcpy(&x, s + i, 8);
+		h = (h ^ x) * HASH_MULTIPLIER;
+		h ^= h >> 32;
+	}
+	x = 0;
+	memcpy(&x, s + i, n - i);
+	h = (h ^ x) * HASH_MULTIPLIER;
+	h = (h ^ (uint64_t)n) * HASH_MULTIPLIER;
+	return h ^ (h >> 32);
+}
+
+static inline uint64_t hash_pair(uint64_t scheme, const char *query, int query_length, const char *target, int target_length)
+{
+	uint64_t h = hash_bytes(scheme, query, query_length);
+	return hash_finalize(hash_bytes(h, target, target_length));
+}
+
+uint64_t result_cache_scheme(const main_opt_t *opt)
+{
+	int32_t values[] = {
+		opt->alignment_mode, opt->library, opt->gap_open, opt->gap_extend, opt->gap_open2, opt->gap_extend2,
+		opt->band_width, opt->zdrop, opt->min_score, opt->add_cigar, opt->find_starts, opt->right_align_gaps,
+		opt->parasail_vec_strat, opt->parasail_score_width
+	};
+	uint64_t h = hash_bytes(CACHE_FILE_VERSION, (const char*)values, sizeof(values));
+	return hash_finalize(hash_bytes(h, (const char*)opt->_matrix, sizeof(opt->_matrix))); // includes -a, -b, and -m
+}
+
+/*****************/
+/* cache_shard_t */
+/*****************/
+
+static inline const char *entry_query(const cache_entry_t *e)
+{
+	return (const char*)(e->data + e->n_cigar);
+}
+
+static inline const char *entry_target(const cache_entry_t *e)
+{
+	return entry_query(e) + e->query_length;
+}
+
+static inline size_t entry_size(int query_length, int target_length, int n_cigar)
+{
+	return sizeof(cache_entry_t) + n_cigar * sizeof(uint32_t) + query_length + target_length;
+}
+
+static inline cache_entry_t **shard_bucket(cache_shard_t *shard, uint64_t key)
+{
+	return &shard->buckets[(key / CACHE_N_SHARDS) & (shard->n_buckets - 1)];
+}
+
+static cache_entry_t *shard_find(cache_shard_t *shard, uint64_t key, uint64_t scheme, const char *query, int query_length, const char *target, int target_length)
+{
+	cache_entry_t *e;
+	if (shard->n_buckets == 0) return NULL;
+	for (e = *shard_bucket(shard, key); e != NULL; e = e->chain) {
+		if (e->key == key && e->scheme == scheme && e->query_length == query_length && e->target_length == target_length
+				&& memcmp(entry_query(e), query, query_length) == 0 && memcmp(entry_target(e), target, target_length) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static void shard_unlink(cache_shard_t *shard, cache_entry_t *e)
+{
+	if (e->prev != NULL) e->prev->next = e->next;
+	else shard->head = e->next;
+	if (e->next != NULL) e->next->prev = e->prev;
+	else shard->tail = e->prev;
+}
+
+static void shard_push_front(cache_shard_t *shard, cache_entry_t *e)
+{
+	e->prev = NULL;
+	e->next = shard->head;
+	if (shard->head != NULL) shard->head->prev = e;
+	else shard->tail = e;
+	shard->head = e;
+}
+
+static void shard_remove(cache_shard_t *shard, cache_entry_t *e)
+{
+	cache_entry_t **p = shard_bucket(shard, e->key);
+	while (*p != e) p = &(*p)->chain;
+	*p = e->chain;
+	shard_unlink(shard, e);
+	shard->size -= e->size;
+	shard->n_entries--;
+	free(e);
+}
+
+// Doubles the buckets once there are more entries than buckets, and returns 0 if that would exceed the memory cap
+static int shard_grow(cache_shard_t *shard)
+{
+	size_t i, n_buckets = shard->n_buckets == 0 ? CACHE_MIN_BUCKETS : shard->n_buckets * 2;
+	cache_entry_t **buckets, *e, *chain;
+
+	if (shard->n_entries < shard->n_buckets) return 1;
+	if (shard->size + (n_buckets - shard->n_buckets) * sizeof(cache_entry_t*) > shard->max_size) return 0;
+	buckets = calloc(n_buckets, sizeof(cache_entry_t*));
+	for (i = 0; i < shard->n_buckets; ++i) {
+		for (e = shard->buckets[i]; e != NULL; e = chain) {
+			chain = e->chain;
+			e->chain = buckets[(e->key / CACHE_N_SHARDS) & (n_buckets - 1)];
+			buckets[(e->key / CACHE_N_SHARDS) & (n_buckets - 1)] = e;
+		}
+	}
+	free(shard->buckets);
+	shard->size += (n_buckets - shard->n_buckets) * sizeof(cache_entry_t*);
+	shard->buckets = buckets;
+	shard->n_buckets = n_buckets;
+	return 1;
+}
+
+/******************/
+/* result_cache_t */
+/******************/
+
+result_cache_t *result_cache_init(size_t max_bytes)
+{
+	int i;
+	result_cache_t *cache = calloc(1, sizeof(result_cache_t));
+	cache->max_size = max_bytes;
+	for (i = 0; i < CACHE_N_SHARDS; ++i) {
+		pthread_mutex_init(&cache->shards[i].mutex, 0);
+		cache->shards[i].max_size = max_bytes / CACHE_N_SHARDS;
+	}
+	return cache;
+}
+
+void result_cache_destroy(result_cache_t *cache)
+{
+	int i;
+	cache_entry_t *e, *next;
+	for (i = 0; i < CACHE_N_SHARDS; ++i) {
+		for (e = cache->shards[i].head; e != NULL; e = next) {
+			next = e->next;
+			free(e);
+		}
+		free(cache->shards[i].buckets);
+		pthread_mutex_destroy(&cache->shards[i].mutex);
+	}
+	free(cache);
+}
+
+int result_cache_get(result_cache_t *cache, uint64_t scheme, const char *query, int query_length, const char *target, int target_length, alignment_t *alignment)
+{
+	uint64_t key = hash_pair(scheme, query, query_length, target, target_length);
+	cache_shard_t *shard = &cache->shards[key & (CACHE_N_SHARDS - 1)];
+	cache_entry_t *e;
+	alignment_t cached;
+
+	pthread_mutex_lock(&shard->mutex);
+	e = shard_find(shard, key, scheme, query, query_length, target, target_length);
+	if (e == NULL) {
+		shard->n_misses++;
+		pthread_mutex_unlock(&shard->mutex);
+		return 0;
+	}
+	shard->n_hits++;
+	shard_unlink(shard, e);
+	shard_push_front(shard, e);
+	memset(&cached, 0, sizeof(alignment_t));
+	cached.score = e->score;
+	cached.qlb = e->qlb;
+	cached.tlb = e->tlb;
+	cached.qle = e->qle;
+	cached.tle = e->tle;
+	cached.cigar = e->data;
+	cached.n_cigar = e->n_cigar;
+	alignment_copy(alignment, &cached);
+	pthread_mutex_unlock(&shard->mutex);
+	return 1;
+}
+
+void result_cache_put(result_cache_t *cache, uint64_t scheme, const char *query, int query_length, const char *target, int target_length, const alignment_t *alignment)
+{
+	uint64_t key = hash_pair(scheme, query, query_length, target, target_length);
+	cache_shard_t *shard = &cache->shards[key & (CACHE_N_SHARDS - 1)];
+	size_t size = entry_size(query_length, target_length, alignment->n_cigar);
+	cache_entry_t *e, **bucket;
+
+	if (size > shard->max_size) return;
+	pthread_mutex_lock(&shard->mutex);
+	if (shard_find(shard, key, scheme, query, query_length, target, target_length) != NULL) { // added by another thread
+		pthread_mutex_unlock(&shard->mutex);
+		return;
+	}
+	while (shard->tail != NULL && shard->size + size > shard->max_size) shard_remove(shard, shard->tail);
+	if (shard->size + size > shard->max_size || !shard_grow(shard)) { // the buckets alone use the memory
+		pthread_mutex_unlock(&shard->mutex);
+		return;
+	}
+
+	e = malloc(size);
+	e->key = key;
+	e->scheme = scheme;
+	e->size = size;
+	e->query_length = query_length;
+	e->target_length = target_length;
+	e->score = alignment->score;
+	e->qlb = alignment->qlb;
+	e->tlb = alignment->tlb;
+	e->qle = alignment->qle;
+	e->tle = alignment->tle;
+	e->n_cigar = alignment->n_cigar;
+	if (alignment->n_cigar > 0) memcpy(e->data, alignment->cigar, alignment->n_cigar * sizeof(uint32_t));
+	memcpy((char*)entry_query(e), query, query_length);
+	memcpy((char*)entry_target(e), target, target_length);
+
+	bucket = shard_bucket(shard, key);
+	e->chain = *bucket;
+	*bucket = e;
+	shard_push_front(shard, e);
+	shard->size += size;
+	shard->n_entries++;
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+int result_cache_load(result_cache_t *cache, const char *fn, char *err)
+{
+	FILE *fp;
+	char magic[sizeof(CACHE_FILE_MAGIC) - 1];
+	uint32_t version;
+	cache_record_t r;
+	alignment_t alignment;
+	char *buf = NULL;
+	size_t m_buf = 0, n;
+	int ret = 0;
+
+	fp = fopen(fn, "rb");
+	if (fp == NULL) {
+		if (errno == ENOENT) return 0; // nothing saved yet
+		return set_error(err, "Could not open the cache file '%s': %s", fn, strerror(errno));
+	}
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic)) != 0
+			|| fread(&version, sizeof(uint32_t), 1, fp) != 1) {
+		fclose(fp);
+		return set_error(err, "The file '%s' is not a cache file (--cache-file).", fn);
+	}
+	if (version != CACHE_FILE_VERSION) {
+		fclose(fp);
+		return set_error(err, "The cache file '%s' has version %u, but only version %d is supported.", fn, version, CACHE_FILE_VERSION);
+	}
+
+	memset(&alignment, 0, sizeof(alignment_t));
+	while ((n = fread(&r, 1, sizeof(cache_record_t), fp)) > 0) {
+		if (n != sizeof(cache_record_t)) {
+			ret = set_error(err, "The cache file '%s' is truncated.", fn);
+			break;
+		}
+		if (r.query_length < 0 || r.target_length < 0 || r.n_cigar < 0) {
+			ret = set_error(err, "The cache file '%s' is malformed.", fn);
+			break;
+		}
+		n = r.n_cigar * sizeof(uint32_t) + (size_t)r.query_length + r.target_length;
+		if (m_buf < n) {
+			m_buf = n;
+			buf = realloc(buf, m_buf);
+		}
+		if (fread(buf, 1, n, fp) != n) {
+			ret = set_error(err, "The cache file '%s' is truncated.", fn);
+			break;
+		}
+		alignment.score = r.score;
+		alignment.qlb = r.qlb;
+		alignment.tlb = r.tlb;
+		alignment.qle = r.qle;
+		alignment.tle = r.tle;
+		alignment.cigar = (uint32_t*)buf;
+		alignment.n_cigar = r.n_cigar;
+		result_cache_put(cache, r.scheme, buf + r.n_cigar * sizeof(uint32_t), r.query_length,
+				buf + r.n_cigar * sizeof(uint32_t) + r.query_length, r.target_length, &alignment);
+	}
+	if (ret == 0 && ferror(fp)) ret = set_error(err, "Could not read the cache file '%s': %s", fn, strerror(errno));
+	free(buf);
+	fclose(fp);
+	return ret;
+}
+
+int result_cache_save(result_cache_t *cache, const char *fn, char *err)
+{
+	FILE *fp;
+	char *tmp_fn;
+	uint32_t version = CACHE_FILE_VERSION;
+	cache_record_t r;
+	cache_entry_t *e;
+	int i, ok;
+
+	tmp_fn = malloc(strlen(fn) + 5);
+	sprintf(tmp_fn, "%s.tmp", fn);
+	fp = fopen(tmp_fn, "wb");
+	if (fp == NULL) {
+		set_error(err, "Could not write the cache file '%s': %s", tmp_fn, strerror(errno));
+		free(tmp_fn);
+		return -1;
+	}
+	ok = fwrite(CACHE_FILE_MAGIC, 1, sizeof(CACHE_FILE_MAGIC) - 1, fp) == sizeof(CACHE_FILE_MAGIC) - 1
+		&& fwrite(&version, sizeof(uint32_t), 1, fp) == 1;
+	for (i = 0; ok && i < CACHE_N_SHARDS; ++i) {
+		cache_shard_t *shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		for (e = shard->tail; ok && e != NULL; e = e->prev) { // oldest first, so loading keeps the order
+			memset(&r, 0, sizeof(cache_record_t));
+			r.scheme = e->scheme;
+			r.query_length = e->query_length;
+			r.target_length = e->target_length;
+			r.score = e->score;
+			r.qlb = e->qlb;
+			r.tlb = e->tlb;
+			r.qle = e->qle;
+			r.tle = e->tle;
+			r.n_cigar = e->n_cigar;
+			ok = fwrite(&r, sizeof(cache_record_t), 1, fp) == 1
+				&& fwrite(e->data, sizeof(uint32_t), e->n_cigar, fp) == (size_t)e->n_cigar
+				&& fwrite(entry_query(e), 1, e->query_length + e->target_length, fp) == (size_t)(e->query_length + e->target_length);
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
+	if (fclose(fp) != 0) ok = 0;
+	if (!ok || rename(tmp_fn, fn) != 0) {
+		set_error(err, "Could not write the cache file '%s': %s", fn, strerror(errno));
+		remove(tmp_fn);
+		free(tmp_fn);
+		return -1;
+	}
+	free(tmp_fn);
+	return 0;
+}
+
+void result_cache_print(const result_cache_t *cache, FILE *fp)
+{
+	uint64_t n_hits = 0, n_misses = 0;
+	size_t n_entries = 0, size = 0;
+	int i;
+	for (i = 0; i < CACHE_N_SHARDS; ++i) {
+		n_hits += cache->shards[i].n_hits;
+		n_misses += cache->shards[i].n_misses;
+		n_entries += cache->shards[i].n_entries;
+		size += cache->shards[i].size;
+	}
+	fprintf(fp, "[cache] %llu hits, %llu misses, %zu entries using %zu bytes (at most %zu)\n",
+			(unsigned long long)n_hits, (unsigned long long)n_misses, n_entries, size, cache->max_size);
+}
@@ -0,0 +1,40 @@
+#ifndef __CACHE_H
+#define __CACHE_H
+
+/* Caches the alignments of pairs (--cache), so a repeated pair, such as a PCR duplicate, a repeated amplicon, or a
+ * retried input, is not aligned again.  The key is a hash of the query, the target, and the options that change the
+ * alignment, but the sequences are kept and compared too, so a collision never returns the wrong alignment.  The cache
+ * is split into shards, each with its own lock and least recently used list, so threads (-t) rarely wait on each other.
+ * Entries are evicted, least recently used first, to keep the sequences, cigars, and bookkeeping under the memory cap.
+ */
+
+typedef struct result_cache_t result_cache_t;
+
+// Creates an empty cache that uses at most max_bytes
+result_cache_t *result_cache_init(size_t max_bytes);
+
+void result_cache_destroy(result_cache_t *cache);
+
+// Returns the hash of the options that change the alignment of a pair: the mode, library, scoring, gaps, band width,
+// z-drop, minimum score, and what is found (-c, -S).  It is the same across runs, so saved entries can be re-used.
+uint64_t result_cache_scheme(const main_opt_t *opt);
+
+// Copies the alignment of the query and target under the scheme into alignment, and returns 1 if it is cached,
+// otherwise returns 0.
+int result_cache_get(result_cache_t *cache, uint64_t scheme, const char *query, int query_length, const char *target, int target_length, alignment_t *alignment);
+
+// Adds the alignment of the query and target under the scheme, evicting the least recently used entries if needed
+void result_cache_put(result_cache_t *cache, uint64_t scheme, const char *query, int query_length, const char *target, int target_length, const alignment_t *alignment);
+
+// Adds the entries saved in the file, oldest first.  A missing file is an empty cache.  Returns 0 on success, otherwise
+// -1 with the message in err.
+int result_cache_load(result_cache_t *cache, const char *fn, char *err);
+
+// Saves the entries to the file, replacing it only once fully written, in the byte order of this machine.  Returns 0 on
+// success, otherwise -1 with the message in err.
+int result_cache_save(result_cache_t *cache, const char *fn, char *err);
+
+// Prints the hits, misses, entries, and memory used (-v)
+void result_cache_print(const result_cache_t *cache, FILE *fp);
+
+#endif
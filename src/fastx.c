@@ -0,0 +1,115 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+#include "ksw2/kseq.h"
+#include "kstring_util.h"
+#include "fastx.h"
+
+KSEQ_INIT(gzFile, gzread)
+
+// the size of zlib's input buffer, larger than its default to make fewer, larger reads
+#define FASTX_GZ_BUFFER_SIZE (1<<20)
+
+struct fastx_reader_t {
+	gzFile fp[2];
+	kseq_t *seq[2];
+	const char *fn[2];
+	int n_files;
+};
+
+static gzFile fastx_open(const char *fn)
+{
+	gzFile fp = (strcmp(fn, "-") == 0) ? gzdopen(fileno(stdin), "r") : gzopen(fn, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: Cannot open sequence file '%s': %s\n", fn, strerror(errno));
+		exit(1);
+	}
+	gzbuffer(fp, FASTX_GZ_BUFFER_SIZE);
+	return fp;
+}
+
+fastx_reader_t *fastx_reader_init(const char *query_fn, const char *target_fn)
+{
+	int i;
+	fastx_reader_t *r = calloc(1, sizeof(fastx_reader_t));
+	r->fn[0] = query_fn;
+	r->fn[1] = target_fn;
+	r->n_files = (target_fn == NULL) ? 1 : 2;
+	for (i = 0; i < r->n_files; ++i) {
+		r->fp[i] = fastx_open(r->fn[i]);
+		r->seq[i] = kseq_init(r->fp[i]);
+	}
+	return r;
+}
+
+// Reads the next record from the i-th file.  Returns 1 if a record was read, 0 at the end of the file.
+static int fastx_reader_read(fastx_reader_t *r, int i, kstring_t *name, kstring_t *seq)
+{
+	int ret = kseq_read(r->seq[i]);
+	if (ret == -1) return 0;
+	if (ret < -1) {
+		fprintf(stderr, "Error: truncated or malformed record in '%s'\n", r->fn[i]);
+		exit(1);
+	}
+	if (ret == 0) {
+		fprintf(stderr, "Error: empty sequence for record '%s' in '%s'\n", r->seq[i]->name.s, r->fn[i]);
+		exit(1);
+	}
+	kstring_copy(name, &r->seq[i]->name);
+	kstring_copy(seq, &r->seq[i]->seq);
+	return 1;
+}
+
+int fastx_reader_next(fastx_reader_t *r, kstring_t *query_name, kstring_t *query, kstring_t *target_name, kstring_t *target)
+{
+	int j = r->n_files - 1; // the file with the targets
+	if (!fastx_reader_read(r, 0, query_name, query)) {
+		if (j == 1 && fastx_reader_read(r, j, target_name, target)) {
+			fprintf(stderr, "Error: more records in '%s' than in '%s'\n", r->fn[1], r->fn[0]);
+			exit(1);
+		}
+		return 0;
+	}
+	if (!fastx_reader_read(r, j, target_name, target)) {
+		if (j == 1) fprintf(stderr, "Error: more records in '%s' than in '%s'\n", r->fn[0], r->fn[1]);
+		else fprintf(stderr, "Error: odd number of records in the interleaved file '%s'\n", r->fn[0]);
+		exit(1);
+	}
+	return 1;
+}
+
+void fastx_reader_destroy(fastx_reader_t *r)
+{
+	int i;
+	for (i = 0; i < r->n_files; ++i) {
+		kseq_destroy(r->seq[i]);
+		gzclose(r->fp[i]);
+	}
+	free(r);
+}
@@ -0,0 +1,15 @@
+#ifndef __FASTX_H
+#define __FASTX_H
+
+typedef struct fastx_reader_t fastx_reader_t;
+
+// Opens FASTA/FASTQ files, which may be gzip-compressed.  Queries are read from query_fn and targets from target_fn,
+// or, if target_fn is NULL, queries and targets alternate (are interleaved) in query_fn.
+fastx_reader_t *fastx_reader_init(const char *query_fn, const char *target_fn);
+
+// Reads the next query and target.  Returns 1 if a pair was read, 0 at the end of the input.
+int fastx_reader_next(fastx_reader_t *r, kstring_t *query_name, kstring_t *query, kstring_t *target_name, kstring_t *target);
+
+void fastx_reader_destroy(fastx_reader_t *r);
+
+#endif
@@ -0,0 +1,271 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ksw2/kseq.h"
+#include "ksw2/ksw2.h"
+#include "parasail/parasail.h"
+#include "main.h"
+#include "interseq.h"
+#include "stats.h"
+
+// scores must stay well inside 16 bits, leaving room to subtract a gap from the smallest score
+#define INTERSEQ_MAX_SCORE 30000
+
+// converts ascii DNA bases to their integer format, where anything other than [ACGTN] cannot use the kernel, as the
+// parasail matrix only knows these five (upper case) bases
+static const uint8_t interseq_nt_table[256] = {
+	['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4, ['N'] = 5 // one more than the code, so that zero is not a base
+};
+
+struct interseq_t {
+	int alignment_mode;
+	int match, mismatch; // the match score, and the (negative) mismatch score
+	int gap_open, gap_extend;
+	int max_length; // the longest sequence that cannot overflow
+#ifdef __SSE2__
+	__m128i *buf; // the query, N mask, H, and E vectors for each query position
+	int m_buf;
+#endif
+	uint8_t *seqs; // the encoded sequences, one query and target per lane
+	int m_seqs;
+};
+
+int interseq_is_supported(const main_opt_t *opt)
+{
+	int i, j;
+	const int8_t *m = opt->_matrix;
+#ifndef __SSE2__
+	return 0;
+#endif
+	if (opt->library != Parasail || opt->add_cigar || opt->find_starts || opt->gap_extend2 > 0) return 0;
+	if (opt->strand != StrandForward) return 0; // one strand per pair
+	if (opt->alignment_mode != Local && opt->alignment_mode != Glocal && opt->alignment_mode != Global) return 0;
+	if (opt->alignment_mode == Global && (opt->band_width != FullBandWidth || opt->zdrop >= 0)) return 0; // no band or z-drop
+	// the kernel only scores matches and mismatches, where N scores zero
+	for (i = 0; i < 5; ++i) {
+		for (j = 0; j < 5; ++j) {
+			int expected = (i == 4 || j == 4) ? 0 : (i == j) ? m[0] : m[1];
+			if (m[i*5+j] != expected) return 0;
+		}
+	}
+	return 1;
+}
+
+interseq_t *interseq_init(const main_opt_t *opt)
+{
+	if (!interseq_is_supported(opt)) return NULL;
+	interseq_t *s = calloc(1, sizeof(interseq_t));
+	s->alignment_mode = opt->alignment_mode;
+	s->match = opt->_matrix[0];
+	s->mismatch = opt->_matrix[1];
+	s->gap_open = opt->gap_open;
+	s->gap_extend = opt->gap_extend;
+	// every step of a path scores at most the largest of a match, mismatch, or a gap opened and extended
+	int max_step = (s->match > -s->mismatch ? s->match : -s->mismatch) + s->gap_open + s->gap_extend;
+	s->max_length = INTERSEQ_MAX_SCORE / max_step / 2 - 1;
+	return s;
+}
+
+void interseq_destroy(interseq_t *s)
+{
+	if (s == NULL) return;
+#ifdef __SSE2__
+	free(s->buf);
+#endif
+	free(s->seqs);
+	free(s);
+}
+
+// Encodes the sequence into out, returning zero if it cannot be aligned with the kernel
+static int interseq_encode(const char *seq, int length, uint8_t *out)
+{
+	int i;
+	for (i = 0; i < length; ++i) {
+		uint8_t c = interseq_nt_table[(uint8_t)seq[i]];
+		if (c == 0) return 0;
+		out[i] = c - 1;
+	}
+	return 1;
+}
+
+#ifdef __SSE2__
+// Fills the DP matrix column by column (target positions), with the query positions in each column, for all lanes at
+// once.  A lane's sequences are padded with N (score zero) to the longest in the group, which cannot change the scores
+// of its real cells, nor tie with its first best cell.
+static void interseq_kernel(interseq_t *s, int n, const int *qls, const int *tls, int ql_max, int tl_max, alignment_t **alignments)
+{
+	int i, j, k;
+	const int mode = s->alignment_mode;
+	const __m128i neg_inf = _mm_set1_epi16(SHRT_MIN), zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+	const __m128i mismatch = _mm_set1_epi16(s->mismatch), match_diff = _mm_set1_epi16(s->match - s->mismatch);
+	const __m128i gap_oe = _mm_set1_epi16(s->gap_open + s->gap_extend), gap_e = _mm_set1_epi16(s->gap_extend);
+	const uint8_t *seqs = s->seqs;
+	__m128i *Q, *QN, *H, *E;
+	__m128i best = zero, best_i = zero, best_j = zero;
+	int16_t glocal_best[INTERSEQ_N_LANES], glocal_best_j[INTERSEQ_N_LANES];
+	int16_t tmp[INTERSEQ_N_LANES];
+
+	if (s->m_buf < 4 * (ql_max + 1)) {
+		s->m_buf = 4 * (ql_max + 1);
+		free(s->buf);
+		s->buf = (__m128i*)malloc(s->m_buf * sizeof(__m128i));
+	}
+	Q = s->buf;
+	QN = Q + ql_max + 1;
+	H = QN + ql_max + 1;
+	E = H + ql_max + 1;
+
+	// the query bases for each lane, padded with N, and a mask of lanes that are not N
+	for (i = 1; i <= ql_max; ++i) {
+		for (k = 0; k < INTERSEQ_N_LANES; ++k) tmp[k] = (k < n && i <= qls[k]) ? seqs[2*k*s->max_length + i - 1] : 4;
+		Q[i] = _mm_loadu_si128((__m128i*)tmp);
+		QN[i] = _mm_xor_si128(_mm_cmpeq_epi16(Q[i], _mm_set1_epi16(4)), _mm_set1_epi16(-1));
+	}
+	// the first column
+	for (i = 1; i <= ql_max; ++i) {
+		H[i] = (mode == Local) ? zero : _mm_set1_epi16(-(s->gap_open + i * s->gap_extend));
+		E[i] = neg_inf;
+	}
+	for (k = 0; k < INTERSEQ_N_LANES; ++k) glocal_best[k] = SHRT_MIN, glocal_best_j[k] = 0;
+
+	for (j = 1; j <= tl_max; ++j) {
+		__m128i T, TN, F = neg_inf, I = zero, col_max = neg_inf, col_i = zero;
+		// the diagonal of, and the cell above, the first query position
+		__m128i diag = (mode == Global) ? _mm_set1_epi16(j == 1 ? 0 : -(s->gap_open + (j - 1) * s->gap_extend)) : zero;
+		__m128i up = (mode == Global) ? _mm_set1_epi16(-(s->gap_open + j * s->gap_extend)) : zero;
+
+		for (k = 0; k < INTERSEQ_N_LANES; ++k) tmp[k] = (k < n && j <= tls[k]) ? seqs[(2*k+1)*s->max_length + j - 1] : 4;
+		T = _mm_loadu_si128((__m128i*)tmp);
+		TN = _mm_xor_si128(_mm_cmpeq_epi16(T, _mm_set1_epi16(4)), _mm_set1_epi16(-1));
+
+		for (i = 1; i <= ql_max; ++i) {
+			// the match or mismatch score, or zero if either base is N
+			__m128i score = _mm_add_epi16(mismatch, _mm_and_si128(_mm_cmpeq_epi16(Q[i], T), match_diff));
+			score = _mm_and_si128(score, _mm_and_si128(QN[i], TN));
+			// a gap in the query (from the left), and in the target (from above)
+			__m128i e = _mm_max_epi16(_mm_subs_epi16(E[i], gap_e), _mm_subs_epi16(H[i], gap_oe));
+			F = _mm_max_epi16(_mm_subs_epi16(F, gap_e), _mm_subs_epi16(up, gap_oe));
+			__m128i h = _mm_max_epi16(_mm_max_epi16(_mm_adds_epi16(diag, score), e), F);
+			if (mode == Local) {
+				h = _mm_max_epi16(h, zero);
+				// the first query position with the best score in this column
+				I = _mm_add_epi16(I, one);
+				__m128i gt = _mm_cmpgt_epi16(h, col_max);
+				col_max = _mm_max_epi16(col_max, h);
+				col_i = _mm_max_epi16(col_i, _mm_and_si128(gt, I));
+			}
+			diag = H[i];
+			H[i] = up = h;
+			E[i] = e;
+		}
+
+		if (mode == Local) { // keep the first column with the best score
+			__m128i gt = _mm_cmpgt_epi16(col_max, best);
+			best = _mm_max_epi16(best, col_max);
+			best_i = _mm_or_si128(_mm_and_si128(gt, col_i), _mm_andnot_si128(gt, best_i));
+			best_j = _mm_or_si128(_mm_and_si128(gt, _mm_set1_epi16(j)), _mm_andnot_si128(gt, best_j));
+		}
+		else { // the last query position, for the lanes whose target is this long or longer
+			for (k = 0; k < n; ++k) {
+				if (qls[k] == 0 || j > tls[k]) continue;
+				int16_t h = ((int16_t*)&H[qls[k]])[k];
+				if (mode == Global) {
+					if (j == tls[k]) glocal_best[k] = h, glocal_best_j[k] = j;
+				}
+				else if (h > glocal_best[k]) glocal_best[k] = h, glocal_best_j[k] = j;
+			}
+		}
+	}
+
+	// set the results, zero-based
+	if (mode == Local) {
+		int16_t scores[INTERSEQ_N_LANES], is[INTERSEQ_N_LANES], js[INTERSEQ_N_LANES];
+		_mm_storeu_si128((__m128i*)scores, best);
+		_mm_storeu_si128((__m128i*)is, best_i);
+		_mm_storeu_si128((__m128i*)js, best_j);
+		for (k = 0; k < n; ++k) {
+			alignments[k]->score = scores[k];
+			alignments[k]->qle = is[k] - 1;
+			alignments[k]->tle = js[k] - 1;
+		}
+	}
+	else {
+		for (k = 0; k < n; ++k) {
+			alignments[k]->score = glocal_best[k];
+			alignments[k]->qle = qls[k] - 1;
+			alignments[k]->tle = glocal_best_j[k] - 1;
+		}
+	}
+	for (k = 0; k < n; ++k) alignments[k]->qlb = alignments[k]->tlb = -1;
+}
+#endif
+
+int interseq_align(interseq_t *s, int n, const char **queries, const int *query_lengths, const char **targets, const int *target_lengths, alignment_t **alignments, int *failed)
+{
+	int k, ql_max = 0, tl_max = 0, n_failed = 0;
+	int qls[INTERSEQ_N_LANES], tls[INTERSEQ_N_LANES];
+	uint64_t cells = 0;
+	STATS_START(stats_start);
+
+	if (s->m_seqs < 2 * INTERSEQ_N_LANES * s->max_length) {
+		s->m_seqs = 2 * INTERSEQ_N_LANES * s->max_length;
+		s->seqs = (uint8_t*)realloc(s->seqs, s->m_seqs);
+	}
+
+	// encode each pair, failing those that are empty, too long, or have other bases
+	for (k = 0; k < n; ++k) {
+		qls[k] = query_lengths[k];
+		tls[k] = target_lengths[k];
+		failed[k] = (qls[k] == 0 || tls[k] == 0 || qls[k] > s->max_length || tls[k] > s->max_length
+				|| !interseq_encode(queries[k], qls[k], s->seqs + 2*k*s->max_length)
+				|| !interseq_encode(targets[k], tls[k], s->seqs + (2*k+1)*s->max_length));
+		if (failed[k]) qls[k] = tls[k] = 0;
+		if (ql_max < qls[k]) ql_max = qls[k];
+		if (tl_max < tls[k]) tl_max = tls[k];
+		cells += (uint64_t)qls[k] * tls[k];
+	}
+	STATS_STAGE(StatsEncode, stats_start);
+
+#ifdef __SSE2__
+	STATS_START(stats_kernel_start);
+	if (ql_max > 0) interseq_kernel(s, n, qls, tls, ql_max, tl_max, alignments);
+	STATS_KERNEL(StatsInterseq, cells, stats_kernel_start);
+#endif
+
+	// a local alignment with a zero score has no well-defined end, so leave it to the library
+	for (k = 0; k < n; ++k) {
+		if (!failed[k] && s->alignment_mode == Local && alignments[k]->score == 0) failed[k] = 1;
+		if (!failed[k]) STATS_ALIGNMENT(qls[k], tls[k]); // the others are counted when aligned with the library
+		n_failed += failed[k];
+	}
+	return n_failed;
+}
@@ -0,0 +1,27 @@
+#ifndef __INTERSEQ_H
+#define __INTERSEQ_H
+
+/* An inter-sequence engine that aligns many short pairs at once, one pair per SIMD lane, rather than vectorizing
+ * within a single alignment as parasail does.  It finds the score and end of local, glocal, and global alignments (no
+ * cigar), with the same results as parasail.  Pairs it cannot align, such as those too long for 16-bit scores, are
+ * failed so the caller can align them with the library instead.
+ */
+
+// the number of pairs aligned at once (16-bit lanes in a 128-bit vector)
+#define INTERSEQ_N_LANES 8
+
+typedef struct interseq_t interseq_t;
+
+// Returns non-zero if the options (library, alignment mode, scoring, and output) can use the engine
+int interseq_is_supported(const main_opt_t *opt);
+
+// Returns NULL if the options cannot use the engine
+interseq_t *interseq_init(const main_opt_t *opt);
+
+void interseq_destroy(interseq_t *s);
+
+// Aligns up to INTERSEQ_N_LANES pairs, setting the score and ends of each alignment.  Sets failed[k] for pairs that
+// were not aligned, and returns the number of such pairs.
+int interseq_align(interseq_t *s, int n, const char **queries, const int *query_lengths, const char **targets, const int *target_lengths, alignment_t **alignments, int *failed);
+
+#endif
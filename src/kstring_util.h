@@ -0,0 +1,21 @@
+#ifndef __KSTRING_UTIL_H
+#define __KSTRING_UTIL_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Helpers for kstring_t, from ksw2/kseq.h, which must be included first. */
+
+// Copies src into dst, growing dst if needed.  dst always ends with a '\0', even if src does not.
+static inline void kstring_copy(kstring_t *dst, const kstring_t *src)
+{
+	if (dst->m < src->l + 1) {
+		dst->m = src->l + 1;
+		dst->s = (char*)realloc(dst->s, dst->m);
+	}
+	memcpy(dst->s, src->s, src->l);
+	dst->s[src->l] = '\0';
+	dst->l = src->l;
+}
+
+#endif
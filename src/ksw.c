@@ -0,0 +1,194 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include "ksw2/kalloc.h"
+#include "ksw2/ksw2.h"
+#include "parasail/parasail.h"
+#include "main.h"
+#include "interseq.h"
+#include "ksw.h"
+
+// the options, kept out of the public header so it needs none of the headers of ksw, ksw2, or parasail
+struct ksw_opt_t {
+	main_opt_t *opt;
+};
+
+struct ksw_ctx_t {
+	main_opt_t *opt;
+	void *library_data;
+	interseq_t *interseq; // NULL unless the options use the inter-sequence engine
+};
+
+ksw_opt_t *ksw_opt_init()
+{
+	ksw_opt_t *opt = calloc(1, sizeof(ksw_opt_t));
+	opt->opt = main_opt_init();
+	return opt;
+}
+
+int ksw_opt_set(ksw_opt_t *opt, int option, const char *value, char *err)
+{
+	main_opt_t *o = opt->opt;
+	long x = 0;
+	char *end;
+	check_or_return(err, option > 0 && strchr("MabqrQEwmzlPWTcSRI", option) != NULL, "Option -%c cannot be set; only -M, -a, -b, -q, -r, -Q, -E, -w, -m, -z, -l, -P, -W, -T, -c, -S, -R, and -I can be.", option);
+	switch (option) {
+		case 'c': o->add_cigar = 1; return 0;
+		case 'S': o->find_starts = 1; return 0;
+		case 'R': o->right_align_gaps = 1; return 0;
+		case 'I': o->inter_seq = 1; return 0;
+		default: break;
+	}
+	check_or_return(err, value != NULL, "Expected a value for -%c.", option);
+	switch (option) { // the file names are owned by the options, as the caller's may not outlive them
+		case 'm':
+			free(o->matrix_fn);
+			o->matrix_fn = strdup(value);
+			return 0;
+		case 'P':
+			free(o->selector_fn);
+			o->selector_fn = strdup(value);
+			return 0;
+		default: break;
+	}
+	errno = 0;
+	x = strtol(value, &end, 10);
+	check_or_return(err, *value != '\0' && *end == '\0' && errno == 0 && INT32_MIN <= x && x <= INT32_MAX, "Expected an integer for -%c, found '%s'.", option, value);
+	switch (option) {
+		case 'M': o->alignment_mode = x; break;
+		case 'a': o->match_score = x; break;
+		case 'b': o->mismatch_score = x; break;
+		case 'q': o->gap_open = x; break;
+		case 'r': o->gap_extend = x; break;
+		case 'Q': o->gap_open2 = x; break;
+		case 'E': o->gap_extend2 = x; break;
+		case 'w': o->band_width = x; break;
+		case 'z': o->zdrop = x; break;
+		case 'l': o->library = x; break;
+		case 'W': o->parasail_score_width = x; break;
+		case 'T': o->min_score = x; break;
+		default: break;
+	}
+	return 0;
+}
+
+int ksw_opt_prepare(ksw_opt_t *opt, char *err)
+{
+	if (main_opt_check(opt->opt, err) != 0 || main_opt_prepare(opt->opt, err) != 0) return -1;
+	check_or_return(err, opt->opt->strand == StrandForward, "Cannot align both strands (--strand) with libksw; align to the reverse complement of the target as another pair.");
+	return 0;
+}
+
+void ksw_opt_destroy(ksw_opt_t *opt)
+{
+	if (opt == NULL) return;
+	free(opt->opt->matrix_fn);
+	free(opt->opt->selector_fn);
+	main_opt_destroy(opt->opt);
+	free(opt);
+}
+
+ksw_ctx_t *ksw_ctx_init(ksw_opt_t *opt, char *err)
+{
+	ksw_ctx_t *ctx;
+	if (opt->opt->_library_func == NULL) {
+		set_error(err, "The options must be prepared (ksw_opt_prepare) before creating a context.");
+		return NULL;
+	}
+	ctx = calloc(1, sizeof(ksw_ctx_t));
+	ctx->opt = opt->opt;
+	if ((ctx->library_data = main_opt_library_data_init(ctx->opt, err)) == NULL) {
+		free(ctx);
+		return NULL;
+	}
+	if (ctx->opt->inter_seq) ctx->interseq = interseq_init(ctx->opt);
+	return ctx;
+}
+
+void ksw_ctx_destroy(ksw_ctx_t *ctx)
+{
+	if (ctx == NULL) return;
+	main_opt_library_data_destroy(ctx->opt, ctx->library_data);
+	if (ctx->interseq != NULL) interseq_destroy(ctx->interseq);
+	free(ctx);
+}
+
+int ksw_align(ksw_ctx_t *ctx, const char *query, int query_length, const char *target, int target_length, alignment_t *alignment, char *err)
+{
+	check_or_return(err, query != NULL && target != NULL && alignment != NULL, "The query, target, and alignment must not be NULL.");
+	check_or_return(err, query_length >= 0 && target_length >= 0, "The query and target lengths must be greater than or equal to zero, found %d and %d.", query_length, target_length);
+	alignment_reset(alignment);
+	ctx->opt->_library_func(query, query_length, target, target_length, ctx->opt, ctx->library_data, alignment);
+	return 0;
+}
+
+int ksw_align_batch(ksw_ctx_t *ctx, int n, const char **queries, const char **targets, alignment_t *alignments, char *err)
+{
+	int i, k, *order, *query_lengths, *target_lengths;
+	check_or_return(err, n >= 0, "The number of pairs must be greater than or equal to zero, found %d.", n);
+	for (i = 0; i < n; ++i) {
+		check_or_return(err, queries[i] != NULL && targets[i] != NULL, "The query and target of pair %d must not be NULL.", i);
+	}
+	if (ctx->interseq == NULL) {
+		for (i = 0; i < n; ++i) ksw_align(ctx, queries[i], strlen(queries[i]), targets[i], strlen(targets[i]), &alignments[i], NULL);
+		return 0;
+	}
+
+	// as for -I, align the pairs in groups of similar lengths, and any the engine could not align one at a time
+	query_lengths = calloc(n, sizeof(int));
+	target_lengths = calloc(n, sizeof(int));
+	for (i = 0; i < n; ++i) {
+		query_lengths[i] = strlen(queries[i]);
+		target_lengths[i] = strlen(targets[i]);
+	}
+	order = pairs_order_by_length(n, query_lengths, target_lengths);
+	for (i = 0; i < n; i += INTERSEQ_N_LANES) {
+		const char *group_queries[INTERSEQ_N_LANES], *group_targets[INTERSEQ_N_LANES];
+		int group_query_lengths[INTERSEQ_N_LANES], group_target_lengths[INTERSEQ_N_LANES];
+		alignment_t *group_alignments[INTERSEQ_N_LANES];
+		int failed[INTERSEQ_N_LANES], m = (n - i < INTERSEQ_N_LANES) ? n - i : INTERSEQ_N_LANES;
+		for (k = 0; k < m; ++k) {
+			group_queries[k] = queries[order[i + k]];
+			group_query_lengths[k] = query_lengths[order[i + k]];
+			group_targets[k] = targets[order[i + k]];
+			group_target_lengths[k] = target_lengths[order[i + k]];
+			group_alignments[k] = &alignments[order[i + k]];
+			alignment_reset(group_alignments[k]);
+		}
+		if (interseq_align(ctx->interseq, m, group_queries, group_query_lengths, group_targets, group_target_lengths, group_alignments, failed) == 0) continue;
+		for (k = 0; k < m; ++k) {
+			if (failed[k]) ksw_align(ctx, group_queries[k], group_query_lengths[k], group_targets[k], group_target_lengths[k], group_alignments[k], NULL);
+		}
+	}
+	free(order);
+	free(query_lengths);
+	free(target_lengths);
+	return 0;
+}
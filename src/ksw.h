@@ -0,0 +1,71 @@
+#ifndef __KSW_H
+#define __KSW_H
+
+/* libksw: aligns pairs in-process, with the same options and results as the ksw executable.
+ *
+ * The options are created with ksw_opt_init(), set as they would be on the command line with ksw_opt_set(), then
+ * prepared once with ksw_opt_prepare().  The prepared options are shared, read-only, by any number of contexts, one
+ * per thread, where each context holds the library data (ksw2's or parasail's) for its thread.  The options are
+ * destroyed with ksw_opt_destroy() after every context.
+ *
+ * Functions never exit: on error they return non-zero (or NULL), with the message in err (at least KSW_ERR_LEN bytes)
+ * if it is not NULL.
+ *
+ * Each pair's result is an alignment_t, created with alignment_init() (or zero-initialized) and destroyed with
+ * alignment_destroy(), re-used from one pair to the next.  The coordinates are zero-based and inclusive, as in the
+ * text output, or -1 if unknown.  The cigar is in ksw2's format (length<<4 | op, where op indexes "MID").
+ *
+ * This header is all that is needed to use the library.  Build with `make lib` for libksw.a and libksw.so, and link
+ * with -lparasail -lz -lpthread -lm.
+ */
+
+#include <stdint.h>
+
+// the size of the buffer for the error message from functions that do not exit
+#define KSW_ERR_LEN 256
+
+typedef struct {
+	int score;
+	int qlb;
+	int tlb;
+	int qle;
+	int tle;
+	uint32_t *cigar;
+	int n_cigar;
+	int m_cigar;
+	int is_rev; // aligned to the reverse complement of the target (--strand)
+} alignment_t;
+
+typedef struct ksw_opt_t ksw_opt_t;
+typedef struct ksw_ctx_t ksw_ctx_t;
+
+// Creates the options, with the same defaults as the ksw executable
+ksw_opt_t *ksw_opt_init();
+
+// Sets an option as on the command line, by its letter and its value, which is ignored for a flag, for example
+// ksw_opt_set(opt, 'M', "3", err).  Only the options that change the alignment may be set: -M, -a, -b, -q, -r, -Q,
+// -E, -w, -m, -z, -l, -P, -W, -T, -c, -S, -R, and -I.  Returns non-zero, with the message in err, if the option is
+// not one of these, or its value is not an integer.
+int ksw_opt_set(ksw_opt_t *opt, int option, const char *value, char *err);
+
+// Validates the options, and sets the scoring matrix and library.  Call once, before creating any context.
+int ksw_opt_prepare(ksw_opt_t *opt, char *err);
+
+void ksw_opt_destroy(ksw_opt_t *opt);
+
+// Creates a context for one thread, using the prepared options.  Returns NULL, with the message in err, on error.
+ksw_ctx_t *ksw_ctx_init(ksw_opt_t *opt, char *err);
+
+void ksw_ctx_destroy(ksw_ctx_t *ctx);
+
+// Aligns a pair.  The sequences need not be NUL-terminated.
+int ksw_align(ksw_ctx_t *ctx, const char *query, int query_length, const char *target, int target_length, alignment_t *alignment, char *err);
+
+// Aligns n pairs of NUL-terminated sequences, where alignments holds n results.  With the inter-sequence engine
+// (-I), pairs of similar lengths are aligned together, otherwise one at a time.
+int ksw_align_batch(ksw_ctx_t *ctx, int n, const char **queries, const char **targets, alignment_t *alignments, char *err);
+
+alignment_t *alignment_init();
+void alignment_destroy(alignment_t *alignment);
+
+#endif
@@ -0,0 +1,97 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "ksw2/ksw2.h"
+#include "ksw2_dispatch.h"
+
+#ifdef KSW_CPU_DISPATCH
+
+// The ksw2 kernels are compiled once per instruction set (see the Makefile); with KSW_CPU_DISPATCH defined, ksw2 names
+// them with the instruction set as a suffix, and we provide ksw_extz2_sse and ksw_extd2_sse here.
+void ksw_extz2_sse2(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
+void ksw_extz2_sse41(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
+void ksw_extd2_sse2(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
+void ksw_extd2_sse41(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez);
+
+enum SimdLevel {
+	SimdUnknown = -1,
+	SimdSse2    = 0,
+	SimdSse41   = 1,
+};
+
+static int ksw2_simd = SimdUnknown;
+static pthread_once_t ksw2_simd_once = PTHREAD_ONCE_INIT;
+
+static void ksw2_dispatch_pick()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.1")) ksw2_simd = SimdSse41;
+	else if (__builtin_cpu_supports("sse2")) ksw2_simd = SimdSse2;
+}
+
+int ksw2_dispatch_init()
+{
+	pthread_once(&ksw2_simd_once, ksw2_dispatch_pick);
+	return ksw2_simd == SimdUnknown ? -1 : 0;
+}
+
+const char *ksw2_dispatch_simd_name()
+{
+	ksw2_dispatch_init();
+	return ksw2_simd == SimdSse41 ? "sse4.1" : ksw2_simd == SimdSse2 ? "sse2" : "none";
+}
+
+void ksw_extz2_sse(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez)
+{
+	if (ksw2_simd == SimdSse41) ksw_extz2_sse41(km, qlen, query, tlen, target, m, mat, q, e, w, zdrop, end_bonus, flag, ez);
+	else ksw_extz2_sse2(km, qlen, query, tlen, target, m, mat, q, e, w, zdrop, end_bonus, flag, ez);
+}
+
+void ksw_extd2_sse(void *km, int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, const int8_t *mat, int8_t q, int8_t e, int8_t q2, int8_t e2, int w, int zdrop, int end_bonus, int flag, ksw_extz_t *ez)
+{
+	if (ksw2_simd == SimdSse41) ksw_extd2_sse41(km, qlen, query, tlen, target, m, mat, q, e, q2, e2, w, zdrop, end_bonus, flag, ez);
+	else ksw_extd2_sse2(km, qlen, query, tlen, target, m, mat, q, e, q2, e2, w, zdrop, end_bonus, flag, ez);
+}
+
+#else // ~KSW_CPU_DISPATCH
+
+// ksw2 was compiled for a single instruction set (ex. NEON through sse2neon)
+int ksw2_dispatch_init() { return 0; }
+
+const char *ksw2_dispatch_simd_name()
+{
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	return "neon";
+#elif defined(__SSE4_1__) && !defined(KSW_SSE2_ONLY)
+	return "sse4.1";
+#else
+	return "sse2";
+#endif
+}
+
+#endif // ~KSW_CPU_DISPATCH
@@ -0,0 +1,12 @@
+#ifndef __KSW2_DISPATCH_H
+#define __KSW2_DISPATCH_H
+
+// Picks the ksw2 kernels for the best instruction set supported by this CPU.  Must be called before the first alignment
+// (main_opt_prepare does so for every library), and only picks once however many threads call it.  Returns 0 on
+// success, or -1 if no instruction set for the kernels is supported.
+int ksw2_dispatch_init();
+
+// The name of the instruction set of the ksw2 kernels in use (ex. "sse4.1", "sse2", or "neon")
+const char *ksw2_dispatch_simd_name();
+
+#endif
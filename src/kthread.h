@@ -0,0 +1,23 @@
+#ifndef KTHREAD_H
+#define KTHREAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// run func(data, i, tid) for i in [0, n) on n_threads threads; tid is in [0, n_threads)
+void kt_for(int n_threads, void (*func)(void*,long,int), void *data, long n);
+
+// as kt_for(), but on a pool of threads created once with kt_forpool_init() and re-used by every call
+void *kt_forpool_init(int n_threads);
+void kt_forpool_destroy(void *fp);
+void kt_forpool(void *fp, void (*func)(void*,long,int), void *data, long n);
+
+// run an n_steps pipeline on n_threads workers; steps of different batches overlap, but each step is run in batch order
+void kt_pipeline(int n_threads, void *(*func)(void*, int, void*), void *shared_data, int n_steps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,38 +26,39 @@
 #include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
 #include <limits.h>
 #include <errno.h>
-//#include "ksw2/kalloc.h"
+#include <fcntl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ksw2/kalloc.h"
 #include "ksw2/kseq.h"
+#include "kstring_util.h"
 #include "ksw2/ksw2.h"
 #include "parasail/parasail.h"
 #include "githash.h"
+#include "kthread.h"
+#include "ksw2_dispatch.h"
+#include "fastx.h"
+#include "writer.h"
 #include "main.h"
+#include "interseq.h"
+#include "binary.h"
+#include "bench.h"
+#include "selector.h"
+#include "server.h"
+#include "scheme.h"
+#include "stats.h"
+#include "mapped.h"
+#include "cache.h"
 
 KSEQ_INIT(int, read)
 
-
-enum Library {
-	LibraryStart = 0,
-	AutoLibrary  = 0,
-	Ksw2         = 1,
-	Parasail     = 2,
-	LibraryEnd   = 2,
-};
-
-enum AlignmentMode {
-	AlignmentModeStart = 0,
-	Local              = 0,
-	Glocal             = 1,
-	Extension          = 2,
-	Global             = 3,
-	AlignmentModeEnd   = 3,
-};
-
 // converts ascii DNA bases to their integer format (only [ACGTacgt], the rest go to N)
 unsigned char seq_nt4_table[256] = {
 	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4, 
@@ -78,34 +79,100 @@ unsigned char seq_nt4_table[256] = {
 	4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4
 };
 
-void fill_matrix(int8_t *matrix, char *fn) {
-	FILE *fp = fopen(fn, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error: Cannot open matrix file '%s': %s\n", fn, strerror(errno));
-		exit(1);
+// Encodes ascii DNA bases to their integer format, as seq_nt4_table, into out.  With SSE2, sixteen bases are encoded
+// at a time: lower-casing with OR 0x20 maps only 'A' and 'a' to 'a' (and so on), and each base subtracts 4 - code from 4
+// where it matches, leaving 4 (N) for anything else.
+static void seq_nt4_encode(const char *seq, int length, uint8_t *out)
+{
+	int i = 0;
+	STATS_START(stats_start);
+#ifdef __SSE2__
+	const __m128i lower = _mm_set1_epi8(0x20), four = _mm_set1_epi8(4);
+	const __m128i a = _mm_set1_epi8('a'), c = _mm_set1_epi8('c'), g = _mm_set1_epi8('g'), t = _mm_set1_epi8('t');
+	for (; i + 16 <= length; i += 16) {
+		__m128i x = _mm_or_si128(_mm_loadu_si128((const __m128i*)(seq + i)), lower);
+		__m128i d = _mm_and_si128(_mm_cmpeq_epi8(x, a), four);
+		d = _mm_add_epi8(d, _mm_and_si128(_mm_cmpeq_epi8(x, c), _mm_set1_epi8(3)));
+		d = _mm_add_epi8(d, _mm_and_si128(_mm_cmpeq_epi8(x, g), _mm_set1_epi8(2)));
+		d = _mm_add_epi8(d, _mm_and_si128(_mm_cmpeq_epi8(x, t), _mm_set1_epi8(1)));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(four, d));
 	}
+#endif
+	for (; i < length; ++i) out[i] = seq_nt4_table[(uint8_t)seq[i]];
+	STATS_STAGE(StatsEncode, stats_start);
+}
+
+// Reverse-complements ascii DNA bases into out, keeping the case, and leaving anything other than [ACGTacgt] as is (so
+// N, like seq_nt4_table, stays N).  With SSE2, sixteen bases at a time are complemented by adding the difference to
+// their complement where they match, as in seq_nt4_encode(), then the bytes are reversed with shuffles.
+static void seq_revcomp(const char *seq, int length, char *out)
+{
+	int i = 0;
+	STATS_START(stats_start);
+#ifdef __SSE2__
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i a = _mm_set1_epi8('a'), c = _mm_set1_epi8('c'), g = _mm_set1_epi8('g'), t = _mm_set1_epi8('t');
+	const __m128i at = _mm_set1_epi8('t' - 'a'), cg = _mm_set1_epi8('g' - 'c');
+	for (; i + 16 <= length; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(seq + length - i - 16));
+		__m128i l = _mm_or_si128(x, lower);
+		__m128i d = _mm_sub_epi8(_mm_and_si128(_mm_cmpeq_epi8(l, a), at), _mm_and_si128(_mm_cmpeq_epi8(l, t), at));
+		d = _mm_add_epi8(d, _mm_sub_epi8(_mm_and_si128(_mm_cmpeq_epi8(l, c), cg), _mm_and_si128(_mm_cmpeq_epi8(l, g), cg)));
+		x = _mm_add_epi8(x, d);
+		// reverse the bytes in each 16-bit word, the words in each half, then the halves
+		x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+		x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0x1B), 0x1B);
+		x = _mm_shuffle_epi32(x, 0x4E);
+		_mm_storeu_si128((__m128i*)(out + i), x);
+	}
+#endif
+	for (; i < length; ++i) {
+		char b = seq[length - i - 1];
+		switch (seq_nt4_table[(uint8_t)b]) {
+			case 0: case 3: b ^= 'A' ^ 'T'; break;
+			case 1: case 2: b ^= 'C' ^ 'G'; break;
+			default: break;
+		}
+		out[i] = b;
+	}
+	STATS_STAGE(StatsEncode, stats_start);
+}
+
+// Formats the error message into err, if not NULL, and returns -1.  Used by functions that do not exit (see ksw.h).
+int set_error(char *err, const char *fmt, ...)
+{
+	if (err != NULL) {
+		va_list args;
+		va_start(args, fmt);
+		vsnprintf(err, KSW_ERR_LEN, fmt, args);
+		va_end(args);
+	}
+	return -1;
+}
+
+// Reads the scoring matrix.  Returns non-zero on error.
+int fill_matrix(int8_t *matrix, const char *fn, char *err) {
+	FILE *fp = fopen(fn, "r");
+	check_or_return(err, fp != NULL, "Cannot open matrix file '%s': %s", fn, strerror(errno));
 	char buffer[256];
-	char *pch;
+	char *pch, *saveptr;
 	int i = 0;
 
 	while (0 < fgets(buffer, 256, fp)) {
-		pch = strtok(buffer, ",\t");
+		pch = strtok_r(buffer, ",\t", &saveptr);
 		while (pch != NULL) {
 			if (25 <= i) {
-				fprintf(stderr, "Too many values in %s\n", fn);
-				exit(1);
+				fclose(fp);
+				return set_error(err, "Too many values in %s", fn);
 			}
 			matrix[i] = atoi(pch);
 			i++;
-			pch = strtok(NULL, ",\t");
+			pch = strtok_r(NULL, ",\t", &saveptr);
 		}
 	}
-	if (i != 16 && i != 25) {
-		fprintf(stderr, "Incorrect # of values (found %d, want 16 or 25) in %s\n", i, fn);
-		exit(1);
-	}
-
 	fclose(fp);
+	check_or_return(err, i == 16 || i == 25, "Incorrect # of values (found %d, want 16 or 25) in %s", i, fn);
+	return 0;
 }
 
 char *alignment_mode_to_str(int mode)
@@ -125,14 +192,37 @@ char *library_to_str(int mode)
 		case AutoLibrary: return "auto";
 		case Ksw2: return "ksw2";
 		case Parasail: return "parasail";
+		case PerPairLibrary: return "per-pair";
 		default: return "unknown";
 	}
 }
 
+const char *strand_to_str(int strand)
+{
+	switch (strand) {
+		case StrandForward: return "forward";
+		case StrandBest: return "best";
+		case StrandBoth: return "both";
+		default: return "unknown";
+	}
+}
+
+int strand_from_str(const char *str)
+{
+	int i;
+	for (i = StrandStart; i <= StrandEnd; ++i) {
+		if (strcmp(str, strand_to_str(i)) == 0) return i;
+	}
+	return -1;
+}
+
 /*****************/
 /** ksw2_data_t **/
 /*****************/
 
+// the kalloc arena is reset after an alignment that grew it beyond this many bytes
+#define KSW2_KM_MAX_CAPACITY (1ULL<<28)
+
 ksw2_data_t *ksw2_data_init(main_opt_t *opt, const int8_t *matrix)
 {
 	ksw2_data_t *data = calloc(1, sizeof(ksw2_data_t));
@@ -141,7 +231,7 @@ ksw2_data_t *ksw2_data_init(main_opt_t *opt, const int8_t *matrix)
 	if (opt->add_cigar != 1) data->ksw2_flags |= KSW_EZ_SCORE_ONLY;
 	memset(&data->ez, 0, sizeof(ksw_extz_t));
 	
-	//data->km = km_init(); FIXME
+	data->km = km_init();
 
 	data->matrix = calloc(1, sizeof(int8_t)*25);
 	memcpy(data->matrix, matrix, sizeof(int8_t)*25);
@@ -150,11 +240,98 @@ ksw2_data_t *ksw2_data_init(main_opt_t *opt, const int8_t *matrix)
 
 }
 
+// Tracks the peak arena usage, and resets the arena if a large pair inflated it
+void ksw2_data_update_km(ksw2_data_t *data)
+{
+	km_stat_t st;
+	km_stat(data->km, &st);
+	if (data->km_peak_capacity < st.capacity) data->km_peak_capacity = st.capacity;
+	if (st.capacity > KSW2_KM_MAX_CAPACITY) {
+		km_destroy(data->km); // also frees the cigar
+		data->km = km_init();
+		memset(&data->ez, 0, sizeof(ksw_extz_t));
+		data->km_n_resets++;
+	}
+}
+
+void ksw2_data_print_stats(FILE *fp, const ksw2_data_t *data)
+{
+	km_stat_t st;
+	km_stat(data->km, &st);
+	fprintf(fp, "[ksw2] kalloc arena: peak capacity %zu bytes, current capacity %zu bytes (%zu available), %d resets\n",
+			data->km_peak_capacity, st.capacity, st.available, data->km_n_resets);
+}
+
+// Grows the scratch space to hold at least n bytes
+static inline uint8_t *ksw2_data_reserve_buf(ksw2_data_t *data, int n)
+{
+	if (data->m_buf < n) {
+		data->m_buf = n;
+		kroundup32(data->m_buf);
+		data->buf = (uint8_t*)realloc(data->buf, data->m_buf);
+		STATS_ALLOC();
+	}
+	return data->buf;
+}
+
+// Gets the query in integer format, re-using the last encoding while the query is unchanged
+static const uint8_t *ksw2_data_get_query(ksw2_data_t *data, const char *query, int query_length)
+{
+	if (data->query_length != query_length || memcmp(data->query, query, query_length) != 0) {
+		if (data->m_query < query_length) {
+			data->m_query = query_length;
+			kroundup32(data->m_query);
+			data->query = (char*)realloc(data->query, data->m_query);
+			data->query_nt4 = (uint8_t*)realloc(data->query_nt4, data->m_query);
+			STATS_ALLOC();
+		}
+		memcpy(data->query, query, query_length);
+		seq_nt4_encode(query, query_length, data->query_nt4);
+		data->query_length = query_length;
+	}
+	return data->query_nt4;
+}
+
+// Finds the start of a local (or glocal) alignment that ends at query_end and target_end, without a traceback.  The
+// prefixes ending there are reversed, and a score-only extension finds where the (reversed) alignment with the best
+// score, or best score reaching the start of the query for glocal, ends.
+void ksw2_find_starts(ksw2_data_t *data, main_opt_t *opt, const char *query, int query_end, const char *target, int target_end, int *query_start, int *target_start)
+{
+	int i, query_length = query_end + 1, target_length = target_end + 1;
+	uint8_t *rev_query, *rev_target;
+
+	*query_start = *target_start = -1;
+	if (query_end < 0 || target_end < 0) return;
+
+	rev_query = ksw2_data_reserve_buf(data, query_length + target_length);
+	rev_target = data->buf + query_length;
+	for (i = 0; i < query_length; ++i) rev_query[i] = seq_nt4_table[(uint8_t)query[query_end - i]];
+	for (i = 0; i < target_length; ++i) rev_target[i] = seq_nt4_table[(uint8_t)target[target_end - i]];
+
+	STATS_START(stats_start);
+	ksw_extz2_sse(data->km, query_length, rev_query, target_length, rev_target, 5, data->matrix, opt->gap_open, opt->gap_extend, -1, -1, 0, KSW_EZ_SCORE_ONLY | KSW_EZ_EXTZ_ONLY, &data->ez);
+	STATS_KERNEL(StatsKsw2Extz2, (uint64_t)query_length * target_length, stats_start);
+	if (opt->alignment_mode == Glocal) {
+		if (data->ez.mqe_t >= 0) {
+			*query_start = 0;
+			*target_start = target_end - data->ez.mqe_t;
+		}
+	}
+	else if (data->ez.max_q >= 0) {
+		*query_start = query_end - data->ez.max_q;
+		*target_start = target_end - data->ez.max_t;
+	}
+	ksw2_data_update_km(data);
+}
+
 void ksw2_data_destroy(ksw2_data_t *data)
 {
+	free(data->buf);
+	free(data->query);
+	free(data->query_nt4);
 	free(data->matrix);
 	kfree(data->km, data->ez.cigar);
-	//km_destroy(data->km); FIXME
+	km_destroy(data->km);
 	free(data);
 }
 
@@ -162,8 +339,9 @@ void ksw2_data_destroy(ksw2_data_t *data)
 /* parasail_data_t */
 /*******************/
 
-// See: https://github.com/jeffdaily/parasail#standard-function-naming-convention
-void parasail_to_func_name(char *parasail_func_name, int alignment_mode, int add_cigar, int vec_strategy)
+// See: https://github.com/jeffdaily/parasail#standard-function-naming-convention.  Returns non-zero, with the message in
+// err, if parasail has no such function.
+int parasail_to_func_name(char *parasail_func_name, int alignment_mode, int add_cigar, int vec_strategy, int use_profile, int score_width, char *err)
 {
 	parasail_func_name[0] = '\0';
 	strcat(parasail_func_name, "parasail");
@@ -173,25 +351,59 @@ void parasail_to_func_name(char *parasail_func_name, int alignment_mode, int add
 	switch (alignment_mode) {
 		case Local: strcat(parasail_func_name, "_sw"); break; // local
 		case Glocal: strcat(parasail_func_name, "_sg_dx"); break; // glocal
-		case Extension: fprintf(stderr, "Parasail does not support extension\n"); exit(1);
+		case Extension: return set_error(err, "Parasail does not support extension.");
 		case Global: strcat(parasail_func_name, "_nw"); break; // global
-		default: fprintf(stderr, "Unknown alignment mode: %d\n", alignment_mode); exit(1);
+		default: return set_error(err, "Unknown alignment mode: %d", alignment_mode);
 	}
 	if (add_cigar == 1) strcat(parasail_func_name, "_trace");
 	switch (vec_strategy) {
 		case 0: strcat(parasail_func_name, "_striped"); break;
 		case 1: strcat(parasail_func_name, "_scan"); break;
 		case 2: strcat(parasail_func_name, "_diag"); break;
-		default: fprintf(stderr, "Unknown parasail vectorization strategy: %d\n", vec_strategy); exit(1);
+		default: return set_error(err, "Unknown parasail vectorization strategy: %d", vec_strategy);
+	}
+	if (use_profile == 1) strcat(parasail_func_name, "_profile");
+	switch (score_width) {
+		case ScoreWidth8: strcat(parasail_func_name, "_8"); break;
+		case ScoreWidth16: strcat(parasail_func_name, "_16"); break;
+		case ScoreWidth32: strcat(parasail_func_name, "_32"); break;
+		default: return set_error(err, "Unknown parasail score width: %d", score_width);
 	}
-	strcat(parasail_func_name, "_32"); // TODO: add this as a command line option?
+	return 0;
 }
 
-parasail_data_t *parasail_data_init(main_opt_t *opt, const int8_t *matrix)
+// Returns NULL, with the message in err, if parasail has no such function
+parasail_function_t *parasail_lookup_function_or_error(int alignment_mode, int add_cigar, int vec_strategy, int score_width, char *err)
+{
+	char parasail_func_name[128];
+	parasail_function_t *func;
+	if (parasail_to_func_name(parasail_func_name, alignment_mode, add_cigar, vec_strategy, 0, score_width, err) != 0) return NULL;
+	func = parasail_lookup_function(parasail_func_name);
+	if (func == NULL) set_error(err, "Unknown parasail function: %s", parasail_func_name);
+	return func;
+}
+
+// Looks up the function that takes a query profile, and the function to create said profile.  Only the striped and scan
+// vectorization strategies have these functions, so NULL is returned when not available.
+parasail_pfunction_t *parasail_lookup_pfunction_and_pcreator(int alignment_mode, int add_cigar, int vec_strategy, int score_width, parasail_pcreator_t **pcreator)
+{
+	char parasail_func_name[128];
+	parasail_pfunction_t *pfunc;
+	*pcreator = NULL;
+	if (vec_strategy != 0 && vec_strategy != 1) return NULL;
+	if (parasail_to_func_name(parasail_func_name, alignment_mode, add_cigar, vec_strategy, 1, score_width, NULL) != 0) return NULL;
+	pfunc = parasail_lookup_pfunction(parasail_func_name);
+	if (pfunc == NULL) return NULL;
+	*pcreator = parasail_lookup_pcreator(parasail_func_name);
+	return (*pcreator == NULL) ? NULL : pfunc;
+}
+
+// Returns NULL, with the message in err, if parasail has no function for the options
+parasail_data_t *parasail_data_init(main_opt_t *opt, const int8_t *matrix, int vec_strategy, char *err)
 {
 	int i, j, l;
 	parasail_data_t *data = calloc(1, sizeof(parasail_data_t));
-	char parasail_func_name[128];
+	int score_widths[3] = { ScoreWidth8, ScoreWidth16, ScoreWidth32 };
 	
 	// create a matrix, don't care about the values
 	data->matrix = parasail_matrix_create("ACGTN", matrix[0], matrix[1]); 
@@ -202,23 +414,92 @@ parasail_data_t *parasail_data_init(main_opt_t *opt, const int8_t *matrix)
 		}
 	}
 
-	parasail_to_func_name(parasail_func_name, opt->alignment_mode, opt->add_cigar, opt->parasail_vec_strat);
-	data->func = parasail_lookup_function(parasail_func_name);
+	// with an automatic score width, try the narrowest (most lanes) first and retry wider when the score saturates
+	if (opt->parasail_score_width == AutoScoreWidth) {
+		for (i = 0; i < 3; ++i) data->score_widths[i] = score_widths[i];
+		data->n_funcs = 3;
+	}
+	else {
+		data->score_widths[0] = opt->parasail_score_width;
+		data->n_funcs = 1;
+	}
+	for (i = 0; i < data->n_funcs; ++i) {
+		data->funcs[i] = parasail_lookup_function_or_error(opt->alignment_mode, opt->add_cigar, vec_strategy, data->score_widths[i], err);
+		if (data->funcs[i] == NULL) {
+			parasail_data_destroy(data);
+			return NULL;
+		}
+		data->pfuncs[i] = parasail_lookup_pfunction_and_pcreator(opt->alignment_mode, opt->add_cigar, vec_strategy, data->score_widths[i], &data->pcreators[i]);
+	}
+
+	// with a minimum score (-T), the score-only functions filter pairs before the traceback.  Their query profile
+	// variant is only used if it shares the profile with the traceback function.
+	if (opt->min_score != INT_MIN && opt->add_cigar == 1) {
+		for (i = 0; i < data->n_funcs; ++i) {
+			parasail_pcreator_t *pcreator;
+			data->score_funcs[i] = parasail_lookup_function_or_error(opt->alignment_mode, 0, vec_strategy, data->score_widths[i], NULL);
+			data->score_pfuncs[i] = parasail_lookup_pfunction_and_pcreator(opt->alignment_mode, 0, vec_strategy, data->score_widths[i], &pcreator);
+			if (pcreator != data->pcreators[i]) data->score_pfuncs[i] = NULL;
+		}
+	}
+
+	// ksw2 is used to find the start of the alignment without a traceback
+	if (opt->find_starts == 1 && opt->add_cigar != 1) {
+		data->ksw2_data = ksw2_data_init(opt, matrix);
+	}
 
 	// the global alignment function is needed for glocal when we don't align the full query
 	if (opt->alignment_mode == Glocal) {
-		data->func_global = data->func;
+		data->func_global = data->funcs[data->n_funcs-1];
 	}
 	else {
-		parasail_to_func_name(parasail_func_name, Global, opt->add_cigar, opt->parasail_vec_strat);
-		data->func_global = parasail_lookup_function(parasail_func_name);
+		data->func_global = parasail_lookup_function_or_error(Global, opt->add_cigar, vec_strategy, data->score_widths[data->n_funcs-1], err);
+		if (data->func_global == NULL) {
+			parasail_data_destroy(data);
+			return NULL;
+		}
 	}
 
 	return data;
 }
 
+// Frees the query profiles, for example when the query changes
+void parasail_data_clear_profiles(parasail_data_t *data)
+{
+	int i;
+	for (i = 0; i < data->n_funcs; ++i) {
+		if (data->profiles[i] != NULL) parasail_profile_free(data->profiles[i]);
+		data->profiles[i] = NULL;
+	}
+	data->profile_query_length = 0;
+}
+
+// Gets the query profile for the i-th score width, building it if the query has changed or it has not been built yet.
+// The query is copied, as the profile keeps a pointer to it.
+parasail_profile_t *parasail_data_get_profile(parasail_data_t *data, int i, const char *query, int query_length)
+{
+	if (data->profile_query_length != query_length || memcmp(data->profile_query, query, query_length) != 0) {
+		parasail_data_clear_profiles(data);
+		if (data->profile_query_max_length < query_length + 1) {
+			data->profile_query_max_length = query_length + 1;
+			data->profile_query = (char*)realloc(data->profile_query, data->profile_query_max_length);
+		}
+		memcpy(data->profile_query, query, query_length);
+		data->profile_query[query_length] = '\0';
+		data->profile_query_length = query_length;
+	}
+	if (data->profiles[i] == NULL) {
+		data->profiles[i] = data->pcreators[i](data->profile_query, query_length, data->matrix);
+		STATS_PROFILE();
+	}
+	return data->profiles[i];
+}
+
 void parasail_data_destroy(parasail_data_t *data)
 {
+	parasail_data_clear_profiles(data);
+	free(data->profile_query);
+	if (data->ksw2_data != NULL) ksw2_data_destroy(data->ksw2_data);
 	parasail_matrix_free(data->matrix);
 	free(data);
 }
@@ -235,7 +516,9 @@ main_opt_t *main_opt_init()
 	opt->mismatch_score = 3;
 	opt->gap_open = 5;
 	opt->gap_extend = 2;
-	opt->band_width = INT_MAX / 4; // divide by four since in some places we multiply by two
+	opt->gap_open2 = 0;
+	opt->gap_extend2 = 0; // no second gap penalty
+	opt->band_width = FullBandWidth;
 	opt->matrix_fn = NULL;
 	opt->alignment_mode = Local;
 	opt->add_cigar = 0;
@@ -244,16 +527,90 @@ main_opt_t *main_opt_init()
 	opt->right_align_gaps = 0;
 	opt->offset_and_length = 0;
 	opt->parasail_vec_strat = 0; // TODO: set on the command line
+	opt->parasail_score_width = AutoScoreWidth;
+	opt->one_vs_many = 0;
+	opt->verbose = 0;
+	opt->find_starts = 0;
+	opt->binary = 0;
+	opt->listen_fn = NULL;
+	opt->strand = StrandForward;
+	opt->input_fn = NULL;
+	opt->query_fn = NULL;
+	opt->target_fn = NULL;
 	opt->zdrop = -1;
 	opt->library = AutoLibrary;
+	opt->n_threads = 1;
+	opt->batch_size = 10000;
+	opt->flush_policy = FlushOnIdle;
+	opt->min_score = INT_MIN;
+	opt->drop_filtered = 0;
+	opt->inter_seq = 0;
+	opt->selector_fn = NULL;
+	opt->cache_size = 0;
+	opt->cache_fn = NULL;
 
 	return opt;
 }
 
-void main_opt_init_library(main_opt_t *opt)
+// Creates the library data for one thread.  Returns NULL, with the message in err, on error.
+void *main_opt_library_data_init(main_opt_t *opt, char *err)
+{
+	switch (opt->library) {
+		case Ksw2: return (void*)ksw2_data_init(opt, opt->_matrix);
+		case Parasail: return (void*)parasail_data_init(opt, opt->_matrix, opt->parasail_vec_strat, err);
+		case PerPairLibrary: return (void*)selector_data_init(opt, err);
+		default:
+			set_error(err, "Unknown library in %s: %d", __func__, opt->library);
+			return NULL;
+	}
+}
+
+void main_opt_library_data_destroy(main_opt_t *opt, void *library_data)
+{
+	if (opt->verbose) {
+		switch (opt->library) {
+			case Ksw2: ksw2_data_print_stats(stderr, (ksw2_data_t*)library_data); break;
+			default: break;
+		}
+	}
+	switch (opt->library) {
+		case Ksw2: ksw2_data_destroy((ksw2_data_t*)library_data); break;
+		case Parasail: parasail_data_destroy((parasail_data_t*)library_data); break;
+		case PerPairLibrary: selector_data_destroy((selector_data_t*)library_data); break;
+		default: break; // never created, see main_opt_library_data_init()
+	}
+}
+
+// Creates library data for each thread, where the first is opt->_library_data.  Returns NULL, with the message in err,
+// on error.
+void **main_opt_thread_data_init(main_opt_t *opt, char *err)
+{
+	int i;
+	void **library_data = calloc(opt->n_threads, sizeof(void*));
+	library_data[0] = opt->_library_data;
+	for (i = 1; i < opt->n_threads; ++i) {
+		if ((library_data[i] = main_opt_library_data_init(opt, err)) == NULL) {
+			while (--i > 0) main_opt_library_data_destroy(opt, library_data[i]);
+			free(library_data);
+			return NULL;
+		}
+	}
+	return library_data;
+}
+
+void main_opt_thread_data_destroy(main_opt_t *opt, void **library_data)
+{
+	int i;
+	for (i = 1; i < opt->n_threads; ++i) main_opt_library_data_destroy(opt, library_data[i]);
+	free(library_data);
+}
+
+// Sets the scoring matrix and chooses the library, but does not create the library data.  Returns non-zero, with the
+// message in err, on error.
+int main_opt_prepare(main_opt_t *opt, char *err)
 {
 	int i, j, k;
-	int8_t matrix[25];
+	int8_t *matrix = opt->_matrix;
 
 	// initialize scoring matrix
 	for (i = k = 0; i < 4; ++i) {
@@ -264,45 +621,52 @@ void main_opt_init_library(main_opt_t *opt)
 	}
 	for (j = 0; j < 5; ++j) matrix[k++] = 0;
 	// overwrite if a matrix file was given
-	if (opt->matrix_fn != NULL) fill_matrix(matrix, opt->matrix_fn);
+	if (opt->matrix_fn != NULL && fill_matrix(matrix, opt->matrix_fn, err) != 0) return -1;
+
+	// pick the ksw2 kernels before any thread aligns, for every library, as parasail also uses ksw2 (-S, and banded or
+	// z-dropped global alignment)
+	check_or_return(err, ksw2_dispatch_init() == 0, "SSE2 is required to run ksw2");
 
 	// adjust the library mode if it is set on auto
 	if (opt->library == AutoLibrary) {
 		switch (opt->alignment_mode) {
 			case Local: 
-			case Glocal: 
-			case Global: opt->library = Parasail; break;
+			case Glocal: opt->library = Parasail; break;
+			case Global: opt->library = (opt->gap_extend2 > 0) ? Ksw2 : Parasail; break; // only ksw2 has two-piece gaps
 			case Extension: opt->library = Ksw2; break;
-			default:
-				fprintf(stderr, "Unknown alignment mode in %s: %d\n", __func__, opt->alignment_mode); 
-				exit(1);
+			default: return set_error(err, "Unknown alignment mode in %s: %d", __func__, opt->alignment_mode);
 		}
 	}
 
 	switch (opt->library) {
-		case Ksw2: 
-			opt->_library_func = align_with_ksw2;
-			opt->_library_data = (void*)ksw2_data_init(opt, matrix); 
+		case Ksw2: opt->_library_func = align_with_ksw2; break;
+		case Parasail: opt->_library_func = align_with_parasail; break;
+		case PerPairLibrary:
+			opt->_selector_model = (opt->selector_fn != NULL) ? selector_model_read(opt, opt->selector_fn, err) : selector_model_calibrate(opt, err);
+			if (opt->_selector_model == NULL) return -1;
+			opt->_library_func = align_with_selector;
 			break;
-		case Parasail: 
-			opt->_library_func = align_with_parasail;
-			opt->_library_data = (void*)parasail_data_init(opt, matrix); 
-			break;
-		default:
-			fprintf(stderr, "Unknown library in %s: %d", __func__, opt->library);
-			exit(1);
+		default: return set_error(err, "Unknown library in %s: %d", __func__, opt->library);
 	}
+	return 0;
 }
 
-void main_opt_destroy(main_opt_t *opt)
+void main_opt_init_library(main_opt_t *opt)
 {
-	switch (opt->library) {
-		case Ksw2: ksw2_data_destroy((ksw2_data_t*)opt->_library_data); break;
-		case Parasail: parasail_data_destroy((parasail_data_t*)opt->_library_data); break;
-		default:
-			fprintf(stderr, "Unknown library in %s: %d", __func__, opt->library);
-			exit(1);
+	char err[KSW_ERR_LEN];
+	assert_or_exit(main_opt_prepare(opt, err) == 0, "%s", err);
+	if (opt->verbose) {
+		if (opt->library == Ksw2) fprintf(stderr, "[ksw2] using the %s kernels\n", ksw2_dispatch_simd_name());
+		if (opt->library == PerPairLibrary) selector_model_write(stderr, opt->_selector_model);
 	}
+	opt->_library_data = main_opt_library_data_init(opt, err);
+	assert_or_exit(opt->_library_data != NULL, "%s", err);
+}
+
+void main_opt_destroy(main_opt_t *opt)
+{
+	if (opt->_library_data != NULL) main_opt_library_data_destroy(opt, opt->_library_data);
+	if (opt->_selector_model != NULL) selector_model_destroy(opt->_selector_model);
 	free(opt);
 }
 
@@ -319,15 +683,38 @@ void assert_or_exit(int condition, const char *fmt, ...)
 	}
 }
 
-void main_opt_validate(main_opt_t *opt)
+// Returns non-zero, with the message in err, if the options are not valid
+int main_opt_check(const main_opt_t *opt, char *err)
 {
-	assert_or_exit(AlignmentModeStart <= opt->alignment_mode && opt->alignment_mode <= AlignmentModeEnd, "Alignment mode (-M) was not valid ([%d-%d]), found %d.", AlignmentModeStart, AlignmentModeEnd, opt->alignment_mode);
-	assert_or_exit(opt->mismatch_score > 0, "Mismatch penalty (-b) must be greater than zero, found %d.", opt->mismatch_score);
-	assert_or_exit(opt->match_score > 0, "Match score (-a) must be greater than zero, found %d.", opt->match_score);
-	assert_or_exit(opt->gap_open >= 0, "Gap open penalty (-q) must be greater than or equal to zero, found %d.", opt->gap_open);
-	assert_or_exit(opt->gap_extend > 0, "Gap extend penalty (-r) must be greater than zero, found %d.", opt->gap_extend);
-	assert_or_exit(0 <= opt->band_width, "Band width (-w) must be greater than or equal zero, found %d.", opt->band_width);
-	assert_or_exit(LibraryStart <= opt->library && opt->library <= LibraryEnd, "Library (-l) was not valid ([%d-%d]), found %d.", LibraryStart, LibraryEnd, opt->library);
+	check_or_return(err, AlignmentModeStart <= opt->alignment_mode && opt->alignment_mode <= AlignmentModeEnd, "Alignment mode (-M) was not valid ([%d-%d]), found %d.", AlignmentModeStart, AlignmentModeEnd, opt->alignment_mode);
+	check_or_return(err, opt->mismatch_score > 0, "Mismatch penalty (-b) must be greater than zero, found %d.", opt->mismatch_score);
+	check_or_return(err, opt->match_score > 0, "Match score (-a) must be greater than zero, found %d.", opt->match_score);
+	check_or_return(err, opt->gap_open >= 0, "Gap open penalty (-q) must be greater than or equal to zero, found %d.", opt->gap_open);
+	check_or_return(err, opt->gap_extend > 0, "Gap extend penalty (-r) must be greater than zero, found %d.", opt->gap_extend);
+	check_or_return(err, opt->gap_open2 >= 0, "Second gap open penalty (-Q) must be greater than or equal to zero, found %d.", opt->gap_open2);
+	check_or_return(err, opt->gap_extend2 >= 0, "Second gap extend penalty (-E) must be greater than or equal to zero, found %d.", opt->gap_extend2);
+	check_or_return(err, opt->gap_open2 == 0 || opt->gap_extend2 > 0, "Second gap extend penalty (-E) must be greater than zero when the second gap open penalty (-Q) is given.");
+	check_or_return(err, AutoBandWidth <= opt->band_width, "Band width (-w) must be greater than or equal zero, or -1 for automatic, found %d.", opt->band_width);
+	check_or_return(err, LibraryStart <= opt->library && opt->library <= LibraryEnd, "Library (-l) was not valid ([%d-%d]), found %d.", LibraryStart, LibraryEnd, opt->library);
+	check_or_return(err, opt->parasail_score_width == AutoScoreWidth || opt->parasail_score_width == ScoreWidth8 || opt->parasail_score_width == ScoreWidth16 || opt->parasail_score_width == ScoreWidth32, "Score width (-W) must be 0, 8, 16, or 32, found %d.", opt->parasail_score_width);
+	check_or_return(err, opt->n_threads > 0, "Number of threads (-t) must be greater than zero, found %d.", opt->n_threads);
+	check_or_return(err, opt->batch_size > 0, "Batch size (-K) must be greater than zero, found %d.", opt->batch_size);
+	check_or_return(err, opt->drop_filtered == 0 || opt->min_score != INT_MIN, "Cannot drop pairs (-D) without a minimum score (-T).");
+	check_or_return(err, opt->drop_filtered == 0 || opt->binary == 0, "Cannot drop pairs (-D) with the binary protocol (-B), which outputs a record for every frame.");
+	check_or_return(err, StrandStart <= opt->strand && opt->strand <= StrandEnd, "Strand (--strand) was not valid ([%d-%d]), found %d.", StrandStart, StrandEnd, opt->strand);
+	check_or_return(err, opt->strand == StrandForward || (opt->binary == 0 && opt->listen_fn == NULL), "Cannot align both strands (--strand) with the binary protocol (-B or --listen).");
+	check_or_return(err, opt->drop_filtered == 0 || opt->listen_fn == NULL, "Cannot drop pairs (-D) with --listen, which outputs a record for every frame.");
+	check_or_return(err, opt->listen_fn == NULL || opt->binary == 0, "Cannot use the binary protocol (-B) on standard input with --listen, which uses it on each connection.");
+	check_or_return(err, opt->listen_fn == NULL || opt->query_fn == NULL, "Cannot use FASTA/FASTQ files with --listen.");
+	check_or_return(err, opt->listen_fn == NULL || opt->one_vs_many == 0, "Cannot use one-vs-many input (-n) with --listen.");
+	check_or_return(err, opt->query_fn == NULL || opt->one_vs_many == 0, "Cannot use one-vs-many input (-n) with FASTA/FASTQ files.");
+	check_or_return(err, opt->query_fn == NULL || opt->binary == 0, "Cannot use the binary protocol (-B) with FASTA/FASTQ files.");
+	check_or_return(err, opt->input_fn == NULL || opt->query_fn == NULL, "Cannot use an input file (-i) with FASTA/FASTQ files.");
+	check_or_return(err, opt->input_fn == NULL || (opt->binary == 0 && opt->listen_fn == NULL), "Cannot use an input file (-i) with the binary protocol (-B or --listen).");
+	check_or_return(err, opt->cache_size >= 0, "Cache size (--cache) must be greater than or equal to zero, found %d.", opt->cache_size);
+	check_or_return(err, opt->cache_fn == NULL || opt->cache_size > 0, "Cannot save the cache (--cache-file) without a cache size (--cache).");
+	check_or_return(err, opt->cache_fn == NULL || opt->library != PerPairLibrary, "Cannot save the cache (--cache-file) when choosing the library per pair (-l %d), as the choice may differ between runs.", PerPairLibrary);
+	check_or_return(err, opt->selector_fn == NULL || opt->library == PerPairLibrary, "Cannot use a cost model (-P) without choosing the library per pair (-l %d).", PerPairLibrary);
 
 	// verify library type with alignment_mode
 	int found_mismatch = 0;
@@ -336,14 +723,29 @@ void main_opt_validate(main_opt_t *opt)
 			if (opt->alignment_mode != Extension && opt->alignment_mode != Global) found_mismatch = 1; 
 			break;
 		case Parasail: 
-			assert_or_exit(opt->right_align_gaps == 0, "Cannot right adjust gaps (-R) with parasail (-l)");
+			check_or_return(err, opt->right_align_gaps == 0, "Cannot right adjust gaps (-R) with parasail (-l)");
+			check_or_return(err, opt->gap_extend2 == 0, "Cannot use a second gap penalty (-Q/-E) with parasail (-l)");
 			if (opt->alignment_mode != Local && opt->alignment_mode != Glocal && opt->alignment_mode != Global) found_mismatch = 1; 
 			break;
+		case PerPairLibrary: // only parasail has local and glocal
+			if (opt->alignment_mode == Local || opt->alignment_mode == Glocal) {
+				check_or_return(err, opt->right_align_gaps == 0, "Cannot right adjust gaps (-R) with parasail (-l)");
+			}
+			break;
 		default: break;
 	}
-	assert_or_exit(found_mismatch == 0, "Cannot use alignment mode (-M) %d-%s with library (-l) %d-%s.", 
+	check_or_return(err, found_mismatch == 0, "Cannot use alignment mode (-M) %d-%s with library (-l) %d-%s.", 
 			opt->alignment_mode, library_to_str(opt->alignment_mode),
 			opt->library, library_to_str(opt->library));
+	check_or_return(err, opt->gap_extend2 == 0 || opt->alignment_mode == Extension || opt->alignment_mode == Global,
+			"Cannot use a second gap penalty (-Q/-E) with alignment mode (-M) %d-%s.", opt->alignment_mode, alignment_mode_to_str(opt->alignment_mode));
+	return 0;
+}
+
+void main_opt_validate(main_opt_t *opt)
+{
+	char err[KSW_ERR_LEN];
+	assert_or_exit(main_opt_check(opt, err) == 0, "%s", err);
 }
 
 /***************/
@@ -359,33 +761,95 @@ void alignment_reset(alignment_t *a)
 {
 	a->qlb = a->tlb = a->qle = a->tle = 0;
 	a->n_cigar = 0;
+	a->is_rev = 0;
+}
+
+// Grows the cigar to hold at least n elements.  The cigar is kept across alignments, so this rarely reallocates.
+static inline void alignment_reserve_cigar(alignment_t *a, int n)
+{
+	if (a->m_cigar < n) {
+		a->m_cigar = n;
+		kroundup32(a->m_cigar);
+		a->cigar = (uint32_t*)realloc(a->cigar, a->m_cigar*sizeof(uint32_t));
+		STATS_ALLOC();
+	}
 }
 
-void alignment_print(FILE *fp, const char *query, const char *target, const main_opt_t *opt, const alignment_t *a) 
+void alignment_copy(alignment_t *dst, const alignment_t *src)
+{
+	alignment_reserve_cigar(dst, src->n_cigar);
+	dst->score = src->score;
+	dst->qlb = src->qlb;
+	dst->tlb = src->tlb;
+	dst->qle = src->qle;
+	dst->tle = src->tle;
+	if (src->n_cigar > 0) memcpy(dst->cigar, src->cigar, src->n_cigar * sizeof(uint32_t));
+	dst->n_cigar = src->n_cigar;
+}
+
+// Returns non-zero if the alignment is below the minimum score (-T) and should not be output (-D)
+static inline int alignment_is_dropped(const main_opt_t *opt, const alignment_t *a)
+{
+	return opt->drop_filtered && a->score < opt->min_score;
+}
+
+// Appends the alignment as a line of tab-separated text.  The query and target need not end with a '\0'.
+void alignment_print(writer_t *w, const char *query_name, const kstring_t *query, const char *target_name, const kstring_t *target, const main_opt_t *opt, const alignment_t *a) 
 {
 	int i;
-	// output the score and start/end or start/length
-	if (opt->offset_and_length == 1) {
-		int qll = a->qle - a->qlb + 1;
-		int tll = a->tle - a->tlb + 1;
-		fprintf(fp, "%d\t%d\t%d\t%d\t%d", a->score, a->qlb, qll, a->tlb, tll);
+	STATS_START(stats_start);
+	// output the query and target names, if read from FASTA/FASTQ
+	if (query_name != NULL) {
+		writer_puts(w, query_name);
+		writer_putc(w, '\t');
+		writer_puts(w, target_name);
+		writer_putc(w, '\t');
 	}
-	else {
-		fprintf(fp, "%d\t%d\t%d\t%d\t%d", a->score, a->qlb, a->qle, a->tlb, a->tle);
+	// output the score and start/end or start/length
+	writer_put_int(w, a->score);
+	writer_putc(w, '\t');
+	writer_put_int(w, a->qlb);
+	writer_putc(w, '\t');
+	writer_put_int(w, (opt->offset_and_length == 1) ? a->qle - a->qlb + 1 : a->qle);
+	writer_putc(w, '\t');
+	writer_put_int(w, a->tlb);
+	writer_putc(w, '\t');
+	writer_put_int(w, (opt->offset_and_length == 1) ? a->tle - a->tlb + 1 : a->tle);
+	// output the strand, where the target coordinates and cigar are on the reverse complement for '-'
+	if (opt->strand != StrandForward) {
+		writer_putc(w, '\t');
+		writer_putc(w, a->is_rev ? '-' : '+');
 	}
 	// output the cigar
 	if (opt->add_cigar == 1) {
-		fputc('\t', fp);
-		if (a->n_cigar == 0) fputc('*', fp);
+		writer_putc(w, '\t');
+		if (a->n_cigar == 0) writer_putc(w, '*');
 		for (i = 0; i < a->n_cigar; ++i) {
-			fprintf(fp, "%d%c", a->cigar[i]>>4, "MID"[a->cigar[i]&0xf]);
+			writer_put_int(w, a->cigar[i]>>4);
+			writer_putc(w, "MID"[a->cigar[i]&0xf]);
 		}
 	}
 	// output the query and target
-	if (opt->add_seq) fprintf(fp, "\t%s\t%s", query, target);
-	// flush the output so no one is waiting on buffering.
-	fputc('\n', fp);
-	fflush(fp);
+	if (opt->add_seq) {
+		writer_putc(w, '\t');
+		writer_write(w, query->s, query->l);
+		writer_putc(w, '\t');
+		writer_write(w, target->s, target->l);
+	}
+	writer_putc(w, '\n');
+	STATS_STAGE(StatsOutput, stats_start);
+}
+
+// Appends the alignments of a pair on the strands chosen by --strand, skipping any that are dropped (-D).  The reverse
+// alignment and target are only used when aligning both strands.
+static void alignment_print_strands(writer_t *w, const char *query_name, const kstring_t *query, const char *target_name, const kstring_t *target, const kstring_t *rev_target, const main_opt_t *opt, const alignment_t *a, const alignment_t *rev)
+{
+	if (opt->strand == StrandBest && rev->score > a->score) { // the forward strand wins ties
+		a = rev;
+		target = rev_target;
+	}
+	if (!alignment_is_dropped(opt, a)) alignment_print(w, query_name, query, target_name, target, opt, a);
+	if (opt->strand == StrandBoth && !alignment_is_dropped(opt, rev)) alignment_print(w, query_name, query, target_name, rev_target, opt, rev);
 }
 
 void alignment_destroy(alignment_t *alignment)
@@ -398,19 +862,143 @@ void alignment_destroy(alignment_t *alignment)
 /* Library-specific aligment methods */
 /*************************************/
 
-void align_with_ksw2(char *query, int query_length, char *target, int target_length, main_opt_t *opt, void* library_data, alignment_t *alignment) {
-	int i;
+// the automatic band width (-w -1) is the difference in the query and target lengths plus this
+#define AUTO_BAND_WIDTH_MARGIN 32
+
+// Gets the band width for the pair, sizing it from the difference in lengths if automatic.  For global alignment, the
+// band is at least the difference in lengths, so that the end of both sequences is within it.
+int pair_band_width(const main_opt_t *opt, int query_length, int target_length)
+{
+	int length_diff = abs(query_length - target_length);
+	if (opt->band_width == AutoBandWidth) return length_diff + AUTO_BAND_WIDTH_MARGIN;
+	if (opt->alignment_mode == Global && opt->band_width < length_diff) return length_diff;
+	return opt->band_width;
+}
+
+// Scores an equal-length pair on the diagonal into score, giving up (returning zero) if a base is not one of [ACGTacgt],
+// or as soon as the score cannot exceed the bound.  With SSE2, sixteen columns at a time are checked for valid bases and
+// matches, and only the mismatches are scored one at a time when the matrix has the same score for every match.
+static int ungapped_score(const char *query, const char *target, int length, const int8_t *matrix, int max_score, int64_t bound, int64_t *score)
+{
+	int i = 0, uniform = (matrix[0] == matrix[6] && matrix[0] == matrix[12] && matrix[0] == matrix[18]);
+	*score = 0;
+#ifdef __SSE2__
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i a = _mm_set1_epi8('a'), c = _mm_set1_epi8('c'), g = _mm_set1_epi8('g'), t = _mm_set1_epi8('t');
+	for (; uniform && i + 16 <= length; i += 16) {
+		__m128i x = _mm_or_si128(_mm_loadu_si128((const __m128i*)(query + i)), lower);
+		__m128i y = _mm_or_si128(_mm_loadu_si128((const __m128i*)(target + i)), lower);
+		__m128i vx = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, a), _mm_cmpeq_epi8(x, c)), _mm_or_si128(_mm_cmpeq_epi8(x, g), _mm_cmpeq_epi8(x, t)));
+		__m128i vy = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(y, a), _mm_cmpeq_epi8(y, c)), _mm_or_si128(_mm_cmpeq_epi8(y, g), _mm_cmpeq_epi8(y, t)));
+		int mismatches = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+		if (_mm_movemask_epi8(_mm_and_si128(vx, vy)) != 0xFFFF) return 0;
+		*score += (16 - __builtin_popcount(mismatches)) * matrix[0];
+		for (; mismatches != 0; mismatches &= mismatches - 1) {
+			int k = i + __builtin_ctz(mismatches);
+			*score += matrix[seq_nt4_table[(uint8_t)query[k]] * 5 + seq_nt4_table[(uint8_t)target[k]]];
+		}
+		if (*score + (int64_t)(length - i - 16) * max_score <= bound) return 0;
+	}
+#endif
+	for (; i < length; ++i) {
+		int x = seq_nt4_table[(uint8_t)query[i]], y = seq_nt4_table[(uint8_t)target[i]];
+		if (x > 3 || y > 3) return 0;
+		*score += matrix[x * 5 + y];
+		if ((i & 15) == 15 && *score + (int64_t)(length - i - 1) * max_score <= bound) return 0;
+	}
+	return *score > bound;
+}
+
+// Aligns an equal-length pair without gaps, setting the score, the ends, and the cigar (-c), and returns non-zero if the
+// DP would find the same alignment, so it may be skipped.  Any other alignment has at most length - 1 aligned columns,
+// each scoring at most the best in the matrix, and at least two gaps for global (one for glocal, none for local), each
+// costing at least the smaller gap open plus extension.  The ungapped score must beat that strictly, so the DP's optimum
+// is unique.  Extension and z-drop (-z) are left to the DP, as is a pair below the minimum score (-T).
+static int align_ungapped(const char *query, int query_length, const char *target, int target_length, const main_opt_t *opt, alignment_t *alignment)
+{
+	const int8_t *matrix = opt->_matrix;
+	int i, j, n_gaps, max_score = INT_MIN, min_gap = opt->gap_open + opt->gap_extend, ret;
+	int64_t score, bound;
+
+	if (query_length != target_length || query_length == 0) return 0;
+	switch (opt->alignment_mode) {
+		case Local: n_gaps = 0; break;
+		case Glocal: n_gaps = 1; break;
+		case Global: n_gaps = 2; break;
+		default: return 0;
+	}
+	if (opt->alignment_mode == Global && opt->zdrop >= 0) return 0;
+	if (opt->gap_extend2 > 0 && opt->gap_open2 + opt->gap_extend2 < min_gap) min_gap = opt->gap_open2 + opt->gap_extend2;
+	for (i = 0; i < 4; ++i) {
+		for (j = 0; j < 4; ++j) {
+			if (max_score < matrix[i * 5 + j]) max_score = matrix[i * 5 + j];
+		}
+	}
+	bound = (int64_t)(query_length - 1) * max_score - (int64_t)n_gaps * min_gap;
+
+	STATS_START(stats_start);
+	ret = ungapped_score(query, target, query_length, matrix, max_score, bound, &score) && score >= opt->min_score;
+	STATS_KERNEL(StatsUngapped, query_length, stats_start);
+	if (!ret) return 0;
+	STATS_SKIP();
+
+	alignment->score = score;
+	alignment->qlb = alignment->tlb = 0;
+	alignment->qle = alignment->tle = query_length - 1;
+	if (opt->add_cigar == 1) {
+		alignment_reserve_cigar(alignment, 1);
+		alignment->cigar[0] = (uint32_t)query_length << 4; // M
+		alignment->n_cigar = 1;
+	}
+	return 1;
+}
+
+// Runs ksw2, with the two-piece affine gap model (ksw_extd2_sse) when a second gap penalty is given
+static inline void ksw2_extend(ksw2_data_t *ksw2_data, main_opt_t *opt, int query_length, const uint8_t *query, int target_length, const uint8_t *target, int flags)
+{
+	int band_width = pair_band_width(opt, query_length, target_length);
+	STATS_START(stats_start);
+	if (opt->gap_extend2 > 0) {
+		ksw_extd2_sse(ksw2_data->km, query_length, query, target_length, target, 5, ksw2_data->matrix, opt->gap_open, opt->gap_extend, opt->gap_open2, opt->gap_extend2, band_width, opt->zdrop, 0, flags, &ksw2_data->ez);
+		STATS_KERNEL(StatsKsw2Extd2, stats_band_cells(query_length, target_length, band_width), stats_start);
+	}
+	else {
+		ksw_extz2_sse(ksw2_data->km, query_length, query, target_length, target, 5, ksw2_data->matrix, opt->gap_open, opt->gap_extend, band_width, opt->zdrop, 0, flags, &ksw2_data->ez);
+		STATS_KERNEL(StatsKsw2Extz2, stats_band_cells(query_length, target_length, band_width), stats_start);
+	}
+}
+
+void align_with_ksw2(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, void* library_data, alignment_t *alignment) {
 	ksw2_data_t *ksw2_data = (ksw2_data_t*)library_data;
 
-	// convert to bases in integer format
-	for (i = 0; i < query_length; ++i) query[i] = seq_nt4_table[(int)query[i]];
-	for (i = 0; i < target_length; ++i) target[i] = seq_nt4_table[(int)target[i]];
+	int flags = ksw2_data->ksw2_flags;
+	switch (opt->alignment_mode) {
+		case Extension: flags |= KSW_EZ_EXTZ_ONLY; break;
+		case Global: break;
+		default: return; // never reached, as main_opt_check() only allows ksw2 with extension and global
+	}
+
+	// skip the DP when the best alignment is provably without gaps
+	if (align_ungapped(query, query_length, target, target_length, opt, alignment)) return;
+
+	// convert to bases in integer format, leaving the input untouched
+	const uint8_t *query_nt4 = ksw2_data_get_query(ksw2_data, query, query_length);
+	uint8_t *target_nt4 = ksw2_data_reserve_buf(ksw2_data, target_length);
+	seq_nt4_encode(target, target_length, target_nt4);
+
+	// with a minimum score (-T), run a score-only pass first so the traceback only runs for pairs that pass.  A pair
+	// that fails keeps the results of the score-only pass, which have no cigar.
+	if (opt->min_score != INT_MIN && (flags & KSW_EZ_SCORE_ONLY) == 0) {
+		ksw2_extend(ksw2_data, opt, query_length, query_nt4, target_length, target_nt4, flags | KSW_EZ_SCORE_ONLY);
+		int score = (opt->alignment_mode == Extension) ? ksw2_data->ez.mqe : ksw2_data->ez.score;
+		if (score >= opt->min_score) ksw2_extend(ksw2_data, opt, query_length, query_nt4, target_length, target_nt4, flags);
+	}
+	else {
+		ksw2_extend(ksw2_data, opt, query_length, query_nt4, target_length, target_nt4, flags);
+	}
 
 	switch (opt->alignment_mode) {
-		case Local: fprintf(stderr, "KSW2 does not support local\n"); exit(1);
-		case Glocal: fprintf(stderr, "KSW2 does not support glocal\n"); exit(1);
 		case Extension: // extend
-			ksw_extz2_sse(0, query_length, (uint8_t*)query, target_length, (uint8_t*)target, 5, ksw2_data->matrix, opt->gap_open, opt->gap_extend, opt->band_width, opt->zdrop, 0, ksw2_data->ksw2_flags | KSW_EZ_EXTZ_ONLY, &ksw2_data->ez);
 			alignment->score   = ksw2_data->ez.mqe; // maximum score when we reach the end of the query
 			if (ksw2_data->ez.max_q < 0) {
 				alignment->qlb = -1;
@@ -426,43 +1014,153 @@ void align_with_ksw2(char *query, int query_length, char *target, int target_len
 			}
 			break;
 		case Global: // global
-			ksw_extz2_sse(0, query_length, (uint8_t*)query, target_length, (uint8_t*)target, 5, ksw2_data->matrix, opt->gap_open, opt->gap_extend, opt->band_width, opt->zdrop, 0, ksw2_data->ksw2_flags, &ksw2_data->ez);
 			alignment->score = ksw2_data->ez.score;
 			alignment->qlb = 0;
 			alignment->tlb = 0;
 			alignment->qle   = query_length-1;
 			alignment->tle   = target_length-1;
 			break;
-		default:
-			fprintf(stderr, "Unknown alignment mode in %s: %d\n", __func__, opt->alignment_mode); 
-			exit(1);
+		default: break;
 	}
 
 	// copy cigar
 	if (opt->add_cigar == 1) {
-		if (alignment->m_cigar < ksw2_data->ez.m_cigar) {
-			alignment->m_cigar = ksw2_data->ez.m_cigar;
-			alignment->cigar = (uint32_t*)realloc(alignment->cigar, alignment->m_cigar*sizeof(uint32_t));
+		alignment_reserve_cigar(alignment, ksw2_data->ez.n_cigar);
+		memcpy(alignment->cigar, ksw2_data->ez.cigar, ksw2_data->ez.n_cigar*sizeof(uint32_t));
+		alignment->n_cigar = ksw2_data->ez.n_cigar;
+	}
+
+	// NB: after the cigar was copied, as a reset frees it
+	ksw2_data_update_km(ksw2_data);
+}
+
+
+// Decodes the parasail cigar into the alignment's cigar in one pass, merging adjacent =/X/M into M.  The merged cigar
+// is never longer than parasail's, so the alignment's cigar is grown at most once up front.  Returns non-zero if the
+// cigar has an operator other than M, =, X, I, or D, which parasail's traceback never gives.
+static int parasail_cigar_to_alignment(const parasail_cigar_t *parasail_cigar, const main_opt_t *opt, alignment_t *alignment)
+{
+	int i, prev_op_int = -1, leading_deletions = 1;
+	alignment_reserve_cigar(alignment, parasail_cigar->len);
+	// NB: recompute beg_ref using leading deletions for glocal alignment
+	// beg_ref can be wrong for glocal.  See: https://github.com/jeffdaily/parasail/issues/97
+	if (opt->alignment_mode == Glocal) alignment->tlb = 0;
+	for (i = 0; i < parasail_cigar->len; ++i) {
+		char op = parasail_cigar_decode_op(parasail_cigar->seq[i]);
+		uint32_t len = parasail_cigar_decode_len(parasail_cigar->seq[i]);
+		int op_int;
+		// "MIDNSHP=XB"
+		switch (op) {
+			case 'M':
+			case '=':
+			case 'X':
+				op_int = 0; break;
+			case 'I':
+				op_int = 1; break;
+			case 'D':
+				op_int = 2; break;
+			default: return -1;
 		}
-		for (i = 0; i < ksw2_data->ez.n_cigar; i++) {
-			alignment->cigar[i] = ksw2_data->ez.cigar[i];
+		if (op_int != 2) leading_deletions = 0;
+		else if (leading_deletions && opt->alignment_mode == Glocal) alignment->tlb += len;
+		if (prev_op_int == op_int) { // add to the previous
+			len += alignment->cigar[alignment->n_cigar-1] >> 4; 
+			alignment->cigar[alignment->n_cigar-1] = len<<4 | op_int;
 		}
-		alignment->n_cigar = ksw2_data->ez.n_cigar;
+		else { // new cigar element
+			alignment->cigar[alignment->n_cigar] = len<<4 | op_int;
+			alignment->n_cigar++;
+		}
+		prev_op_int = op_int;
 	}
+	return 0;
+}
 
-	// convert back to bases
-	for (i = 0; i < query_length; ++i) query[i] = "ACGTN"[(int)query[i]];
-	for (i = 0; i < target_length; ++i) target[i] = "ACGTN"[(int)target[i]];
+// Aligns with the i-th score width of the given functions, retrying wider while the score saturates.  On return, i is
+// the score width used.
+static parasail_result_t *parasail_align_widths(parasail_data_t *parasail_data, parasail_function_t **funcs, parasail_pfunction_t **pfuncs, int *i, const char *query, int query_length, const char *target, int target_length, const main_opt_t *opt)
+{
+	parasail_result_t *parasail_result;
+	for (;;) {
+		STATS_START(stats_start);
+		if (pfuncs[*i] != NULL && query_length > 0) { // re-use the query profile while the query is unchanged
+			parasail_profile_t *profile = parasail_data_get_profile(parasail_data, *i, query, query_length);
+			parasail_result = pfuncs[*i](profile, target, target_length, opt->gap_open + opt->gap_extend, opt->gap_extend);
+		}
+		else {
+			parasail_result = funcs[*i](query, query_length, target, target_length, opt->gap_open + opt->gap_extend, opt->gap_extend, parasail_data->matrix);
+		}
+		STATS_KERNEL(parasail_data->score_widths[*i] == ScoreWidth8 ? StatsParasail8 : parasail_data->score_widths[*i] == ScoreWidth16 ? StatsParasail16 : StatsParasail32, (uint64_t)query_length * target_length, stats_start);
+		if (*i == parasail_data->n_funcs - 1 || !parasail_result_is_saturated(parasail_result)) break;
+		parasail_result_free(parasail_result);
+		(*i)++;
+	}
+	return parasail_result;
 }
 
+// Runs a banded global alignment, with parasail for the score only, otherwise with ksw2 since parasail's banded function
+// has no traceback nor z-drop
+static void align_with_parasail_banded(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, parasail_data_t *parasail_data, alignment_t *alignment)
+{
+	if (opt->add_cigar == 1 || opt->zdrop >= 0) {
+		if (parasail_data->ksw2_data == NULL) parasail_data->ksw2_data = ksw2_data_init(opt, opt->_matrix);
+		align_with_ksw2(query, query_length, target, target_length, opt, parasail_data->ksw2_data, alignment);
+	}
+	else {
+		int band_width = pair_band_width(opt, query_length, target_length); // reaches the end of the longer sequence
+		STATS_START(stats_start);
+		parasail_result_t *parasail_result = parasail_nw_banded(query, query_length, target, target_length, opt->gap_open + opt->gap_extend, opt->gap_extend, band_width, parasail_data->matrix);
+		STATS_KERNEL(StatsParasailBanded, stats_band_cells(query_length, target_length, band_width), stats_start);
+		alignment->score = parasail_result->score;
+		alignment->qle = parasail_result->end_query;
+		alignment->tle = parasail_result->end_ref;
+		parasail_result_free(parasail_result);
+	}
+	// the start is only known with the cigar or -S, as for parasail
+	if (opt->add_cigar != 1) alignment->qlb = alignment->tlb = (opt->find_starts == 1) ? 0 : -1;
+}
 
-void align_with_parasail(char *query, int query_length, char *target, int target_length, main_opt_t *opt, void *library_data, alignment_t *alignment)
+void align_with_parasail(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, void *library_data, alignment_t *alignment)
 {
 	parasail_data_t *parasail_data = (parasail_data_t*)library_data;
 	int i;
 	parasail_result_t *parasail_result;
 	parasail_cigar_t *parasail_cigar;
-	parasail_result = parasail_data->func(query, query_length, target, target_length, opt->gap_open + opt->gap_extend, opt->gap_extend, parasail_data->matrix);
+
+	// skip the DP when the best alignment is provably without gaps, with the starts as below
+	if (align_ungapped(query, query_length, target, target_length, opt, alignment)) {
+		if (opt->add_cigar != 1) alignment->qlb = alignment->tlb = (opt->find_starts == 1) ? 0 : -1;
+		return;
+	}
+
+	// a banded (or z-dropped) global alignment avoids filling the full matrix
+	if (opt->alignment_mode == Global && (opt->band_width != FullBandWidth || opt->zdrop >= 0)) {
+		align_with_parasail_banded(query, query_length, target, target_length, opt, parasail_data, alignment);
+		return;
+	}
+
+	// skip score widths that cannot hold the best possible score
+	int max_score = (query_length < target_length ? query_length : target_length) * parasail_data->matrix->max;
+	for (i = 0; i < parasail_data->n_funcs - 1; ++i) {
+		if (max_score < (1 << (parasail_data->score_widths[i] - 1)) - 1) break;
+	}
+
+	// with a minimum score (-T), run a score-only pass first so the traceback only runs for pairs that pass.  The
+	// traceback then starts at the score width that did not saturate.
+	if (parasail_data->score_funcs[0] != NULL) {
+		parasail_result = parasail_align_widths(parasail_data, parasail_data->score_funcs, parasail_data->score_pfuncs, &i, query, query_length, target, target_length, opt);
+		if (parasail_result->score < opt->min_score) {
+			alignment->score = parasail_result->score;
+			alignment->qle = parasail_result->end_query;
+			alignment->tle = parasail_result->end_ref;
+			alignment->qlb = -1;
+			alignment->tlb = -1;
+			parasail_result_free(parasail_result);
+			return;
+		}
+		parasail_result_free(parasail_result);
+	}
+	parasail_result = parasail_align_widths(parasail_data, parasail_data->funcs, parasail_data->pfuncs, &i, query, query_length, target, target_length, opt);
 
 	// set the score
 	alignment->score = parasail_result->score;
@@ -473,54 +1171,25 @@ void align_with_parasail(char *query, int query_length, char *target, int target
 
 	// add the cigar, and if so, set the alignment beginning
 	if (opt->add_cigar == 1) {
+		STATS_START(stats_start);
 		parasail_cigar = parasail_result_get_cigar(parasail_result, query, query_length, target, target_length, parasail_data->matrix);
 		alignment->qlb = parasail_cigar->beg_query;
 		alignment->tlb = parasail_cigar->beg_ref;
-		// NB: recompute beg_ref using leading deletions for glocal alignment
-		// beg_ref can be wrong for glocal.  See: https://github.com/jeffdaily/parasail/issues/97
-		if (opt->alignment_mode == Glocal) {
-			alignment->tlb = 0;
-			for (i = 0; i < parasail_cigar->len; ++i) {
-				char op = parasail_cigar_decode_op(parasail_cigar->seq[i]);
-				if (op != 'D') break;
-				uint32_t len = parasail_cigar_decode_len(parasail_cigar->seq[i]);
-				alignment->tlb += len;
-			}
-		}
-		int prev_op_int = -1;
-		for (i = 0; i < parasail_cigar->len; ++i) {
-			char op = parasail_cigar_decode_op(parasail_cigar->seq[i]);
-			int op_int;
-			// "MIDNSHP=XB"
-			switch (op) {
-				case 'M':
-				case '=':
-				case 'X':
-					op_int = 0; break;
-				case 'I':
-					op_int = 1; break;
-				case 'D':
-					op_int = 2; break;
-				default:
-					fprintf(stderr, "Unknown cigar type: %c\n", op);
-					exit(1);
-			}
-			uint32_t len = parasail_cigar_decode_len(parasail_cigar->seq[i]);
-			if (prev_op_int == op_int) { // add to the previous
-				len += alignment->cigar[alignment->n_cigar-1] >> 4; 
-				alignment->cigar[alignment->n_cigar-1] = len<<4 | op_int;
-			}
-			else { // new cigar element
-				if (alignment->n_cigar == alignment->m_cigar) {
-					alignment->m_cigar = alignment->m_cigar ? (alignment->m_cigar)<<1 : 4;
-					alignment->cigar = (uint32_t*)realloc(alignment->cigar, alignment->m_cigar*sizeof(uint32_t));
-				}
-				alignment->cigar[alignment->n_cigar] = len<<4 | op_int;
-				alignment->n_cigar++;
-			}
-			prev_op_int = op_int;
-		}
+		if (parasail_cigar_to_alignment(parasail_cigar, opt, alignment) != 0) alignment->n_cigar = 0; // output as "*"
 		parasail_cigar_free(parasail_cigar);
+		STATS_STAGE(StatsCigar, stats_start);
+	}
+	else if (opt->find_starts == 1 && alignment->score >= opt->min_score) { // NB: no need to find starts of filtered pairs
+		switch (opt->alignment_mode) {
+			case Local:
+			case Glocal:
+				ksw2_find_starts(parasail_data->ksw2_data, opt, query, alignment->qle, target, alignment->tle, &alignment->qlb, &alignment->tlb);
+				break;
+			default:
+				alignment->qlb = 0;
+				alignment->tlb = 0;
+				break;
+		}
 	}
 	else {
 		alignment->qlb = -1;
@@ -529,36 +1198,554 @@ void align_with_parasail(char *query, int query_length, char *target, int target
 	parasail_result_free(parasail_result);
 }
 
-void align(char *query, char *target, main_opt_t *opt, alignment_t *alignment) 
+void align_pair(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, void *library_data, alignment_t *alignment) 
 {
-	int ql = strlen(query); // query length
-	int tl = strlen(target); // target length
-
-	// remove ending newlines
-	if (ql > 0 && query[ql-1] == '\n') { query[ql-1] = '\0'; ql--; }
-	if (tl > 0 && target[tl-1] == '\n') { target[tl-1] = '\0'; tl--; }
+	uint64_t scheme = 0;
 
 	// reset the alignment
 	alignment_reset(alignment);
 
+	// re-use the alignment of a repeated pair (--cache)
+	if (opt->_cache != NULL) {
+		scheme = result_cache_scheme(opt);
+		if (result_cache_get(opt->_cache, scheme, query, query_length, target, target_length, alignment)) return;
+	}
+
+	// do the alignment
+	STATS_ALIGNMENT(query_length, target_length);
+	opt->_library_func(query, query_length, target, target_length, opt, library_data, alignment);
+	if (opt->_cache != NULL) result_cache_put(opt->_cache, scheme, query, query_length, target, target_length, alignment);
+}
+
+// Aligns the query to the target, and with --strand also to its reverse complement, written into rev_target.  The second
+// pass re-uses the encoded query (ksw2) or query profile (parasail), as the query is unchanged.
+static void align_pair_strands(const kstring_t *query, const kstring_t *target, kstring_t *rev_target, main_opt_t *opt, void *library_data, alignment_t *alignment, alignment_t *rev_alignment)
+{
+	int tl = target->l;
+	align_pair(query->s, query->l, target->s, target->l, opt, library_data, alignment);
+	if (opt->strand == StrandForward) return;
+	if (rev_target->m < (size_t)tl + 1) {
+		rev_target->m = tl + 1;
+		kroundup32(rev_target->m);
+		rev_target->s = (char*)realloc(rev_target->s, rev_target->m);
+	}
+	seq_revcomp(target->s, tl, rev_target->s);
+	rev_target->s[tl] = '\0';
+	rev_target->l = tl;
+	align_pair(query->s, query->l, rev_target->s, tl, opt, library_data, rev_alignment);
+	rev_alignment->is_rev = 1;
+}
+
+void align(writer_t *w, const char *query_name, const kstring_t *query, const char *target_name, const kstring_t *target, kstring_t *rev_target, main_opt_t *opt, alignment_t *alignment, alignment_t *rev_alignment) 
+{
 	// do the alignment
-	opt->_library_func(query, ql, target, tl, opt, opt->_library_data, alignment);
+	align_pair_strands(query, target, rev_target, opt, opt->_library_data, alignment, rev_alignment);
 
 	// print it
-	alignment_print(stdout, query, target, opt, alignment);
+	alignment_print_strands(w, query_name, query, target_name, target, rev_target, opt, alignment, rev_alignment);
+}
+
+/*****************/
+/* pair_reader_t */
+/*****************/
+
+// Reads pairs either as alternating queries and targets, or (one-vs-many) as a query, the number of targets N, then N
+// targets.  Alternatively, reads pairs from FASTA/FASTQ files.  On standard input, a line starting with '#' in place
+// of a query is a command (see scheme.h).  From a mapped file (-i), each query and target is a view into the mapping,
+// a kstring_t with no memory of its own (m is zero) nor an ending '\0', and must not be modified or freed.
+enum PairReaderResult {
+	PairReaderEnd     = 0,
+	PairReaderPair    = 1,
+	PairReaderCommand = 2, // the command line is in the query
+};
+
+typedef struct {
+	fastx_reader_t *fastx; // NULL unless reading FASTA/FASTQ
+	mapped_file_t *mapped; // NULL unless reading a mapped file (-i)
+	int fd; // the input file (-i), or -1 for standard input
+	kstream_t *fp;
+	int one_vs_many;
+	int n_targets_left;
+	kstring_t query; // the current query when one-vs-many
+	kstring_t count;
+	kstring_t line; // the rest of a command line
+} pair_reader_t;
+
+pair_reader_t *pair_reader_init(kstream_t *fp, int one_vs_many)
+{
+	pair_reader_t *r = calloc(1, sizeof(pair_reader_t));
+	r->fd = -1;
+	r->fp = fp;
+	r->one_vs_many = one_vs_many;
+	return r;
+}
+
+pair_reader_t *pair_reader_init_fastx(const char *query_fn, const char *target_fn)
+{
+	pair_reader_t *r = calloc(1, sizeof(pair_reader_t));
+	r->fd = -1;
+	r->fastx = fastx_reader_init(query_fn, target_fn);
+	return r;
+}
+
+// Reads pairs from a file mapped into memory, or with plain reads (as for standard input) if it cannot be mapped, such
+// as a pipe
+pair_reader_t *pair_reader_init_file(const char *fn, int one_vs_many)
+{
+	pair_reader_t *r = calloc(1, sizeof(pair_reader_t));
+	r->fd = open(fn, O_RDONLY);
+	assert_or_exit(r->fd >= 0, "Cannot open the input file (-i) '%s': %s", fn, strerror(errno));
+	r->mapped = mapped_file_init(r->fd);
+	if (r->mapped == NULL) r->fp = ks_init(r->fd);
+	r->one_vs_many = one_vs_many;
+	return r;
+}
+
+// Frees the string, unless it is a view into a mapped file
+static inline void kstring_free(kstring_t *s)
+{
+	if (s->m > 0) free(s->s);
+}
+
+// Reads the rest of the line of a command into the query
+static int pair_reader_command(pair_reader_t *r, kstring_t *query, int delimiter)
+{
+	int retval = 0;
+	if (delimiter != '\n' && ks_getuntil(r->fp, KS_SEP_LINE, &r->line, &retval) > 0) {
+		if (query->m < query->l + r->line.l + 2) {
+			query->m = query->l + r->line.l + 2;
+			query->s = (char*)realloc(query->s, query->m);
+		}
+		query->s[query->l++] = ' ';
+		memcpy(query->s + query->l, r->line.s, r->line.l + 1);
+		query->l += r->line.l;
+	}
+	return PairReaderCommand;
+}
+
+// Sets s to a view of the next token of the mapped file, split as ks_getuntil() splits standard input.  Returns zero
+// at the end of the file, or, as ks_getuntil() on standard input, at an empty token.
+static int pair_reader_view(pair_reader_t *r, kstring_t *s, int *delimiter)
+{
+	const char *token;
+	int length;
+	if (!mapped_file_next_token(r->mapped, &token, &length, delimiter) || length == 0) return 0;
+	s->s = (char*)token;
+	s->l = length;
+	s->m = 0;
+	return 1;
+}
+
+// Copies the number of targets, which is parsed as a string, then sets s to a view of the copy
+static void pair_reader_view_copy(kstring_t *s, kstring_t *copy)
+{
+	if (copy->m < s->l + 1) {
+		copy->m = s->l + 1;
+		copy->s = (char*)realloc(copy->s, copy->m);
+	}
+	memcpy(copy->s, s->s, s->l);
+	copy->s[s->l] = '\0';
+	copy->l = s->l;
+	s->s = copy->s;
+}
+
+// Copies a command (with the rest of its line, as pair_reader_command()), which is parsed as a string, into copy, then
+// sets s to a view of the copy
+static int pair_reader_view_command(pair_reader_t *r, kstring_t *s, kstring_t *copy, int delimiter)
+{
+	const char *line = NULL;
+	int length = 0;
+	if (delimiter != '\n') mapped_file_next_line(r->mapped, &line, &length);
+	if (copy->m < s->l + length + 2) {
+		copy->m = s->l + length + 2;
+		copy->s = (char*)realloc(copy->s, copy->m);
+	}
+	memcpy(copy->s, s->s, s->l);
+	copy->l = s->l;
+	if (length > 0) {
+		copy->s[copy->l++] = ' ';
+		memcpy(copy->s + copy->l, line, length);
+		copy->l += length;
+	}
+	copy->s[copy->l] = '\0';
+	s->s = copy->s;
+	s->l = copy->l;
+	return PairReaderCommand;
+}
+
+static int pair_reader_read_mapped(pair_reader_t *r, kstring_t *query, kstring_t *target)
+{
+	int delimiter;
+	kstring_t count;
+	if (r->one_vs_many == 0) {
+		if (!pair_reader_view(r, query, &delimiter)) return PairReaderEnd;
+		if (query->s[0] == '#') return pair_reader_view_command(r, query, &r->line, delimiter);
+		return pair_reader_view(r, target, &delimiter);
+	}
+	while (r->n_targets_left == 0) {
+		if (!pair_reader_view(r, &r->query, &delimiter)) return PairReaderEnd;
+		if (r->query.s[0] == '#') {
+			*query = r->query;
+			return pair_reader_view_command(r, query, &r->line, delimiter);
+		}
+		if (!pair_reader_view(r, &count, &delimiter)) return PairReaderEnd;
+		pair_reader_view_copy(&count, &r->count);
+		r->n_targets_left = atoi(r->count.s);
+		assert_or_exit(r->n_targets_left >= 0, "The number of targets must be greater than or equal to zero, found %s.", r->count.s);
+	}
+	if (!pair_reader_view(r, target, &delimiter)) return PairReaderEnd;
+	r->n_targets_left--;
+	*query = r->query; // NB: no copy, as the view is never modified
+	return PairReaderPair;
+}
+
+// Returns PairReaderPair if a pair was read, PairReaderCommand if a command was read, or PairReaderEnd otherwise.  The
+// names are only set when reading FASTA/FASTQ.
+static int pair_reader_read(pair_reader_t *r, kstring_t *query_name, kstring_t *query, kstring_t *target_name, kstring_t *target)
+{
+	int retval = 0;
+	if (r->fastx != NULL) {
+		return fastx_reader_next(r->fastx, query_name, query, target_name, target);
+	}
+	if (r->mapped != NULL) return pair_reader_read_mapped(r, query, target);
+	if (r->one_vs_many == 0) {
+		if (ks_getuntil(r->fp, 0, query, &retval) <= 0) return PairReaderEnd;
+		if (query->s[0] == '#') return pair_reader_command(r, query, retval);
+		return ks_getuntil(r->fp, 0, target, &retval) > 0;
+	}
+	while (r->n_targets_left == 0) {
+		if (ks_getuntil(r->fp, 0, &r->query, &retval) <= 0) return PairReaderEnd;
+		if (r->query.s[0] == '#') {
+			kstring_copy(query, &r->query);
+			return pair_reader_command(r, query, retval);
+		}
+		if (ks_getuntil(r->fp, 0, &r->count, &retval) <= 0) return PairReaderEnd;
+		r->n_targets_left = atoi(r->count.s);
+		assert_or_exit(r->n_targets_left >= 0, "The number of targets must be greater than or equal to zero, found %s.", r->count.s);
+	}
+	if (ks_getuntil(r->fp, 0, target, &retval) <= 0) return PairReaderEnd;
+	r->n_targets_left--;
+	// copy the query, as the caller may modify it
+	kstring_copy(query, &r->query);
+	return PairReaderPair;
+}
+
+int pair_reader_next(pair_reader_t *r, kstring_t *query_name, kstring_t *query, kstring_t *target_name, kstring_t *target)
+{
+	STATS_START(stats_start);
+	int ret = pair_reader_read(r, query_name, query, target_name, target);
+	STATS_STAGE(StatsParse, stats_start);
+	return ret;
+}
+
+// Returns non-zero if no more input is buffered, so reading the next pair may block.  Input from FASTA/FASTQ files or
+// a mapped file is never considered idle.
+int pair_reader_is_idle(const pair_reader_t *r)
+{
+	return r->fastx == NULL && r->mapped == NULL && r->fp->begin >= r->fp->end;
+}
+
+void pair_reader_destroy(pair_reader_t *r)
+{
+	if (r->fastx != NULL) fastx_reader_destroy(r->fastx);
+	if (r->mapped != NULL) mapped_file_destroy(r->mapped);
+	if (r->fd >= 0) {
+		if (r->fp != NULL) ks_destroy(r->fp);
+		close(r->fd);
+	}
+	kstring_free(&r->query);
+	free(r->count.s);
+	free(r->line.s);
+	free(r);
+}
+
+// Returns the scheme for a command line, releasing the current one.  A malformed command is reported, and the current
+// scheme kept, so one bad line does not end the run.
+static scheme_t *scheme_switch(scheme_cache_t *schemes, scheme_t *scheme, const char *line)
+{
+	char err[KSW_ERR_LEN];
+	scheme_t *next = scheme_cache_get(schemes, line, err);
+	if (next == NULL) {
+		fprintf(stderr, "Error: %s The scoring is not changed.\n", err);
+		return scheme;
+	}
+	scheme_cache_release(schemes, scheme);
+	return next;
+}
+
+/*********************/
+/* batch (-t) mode   */
+/*********************/
+
+typedef struct {
+	main_opt_t *opt;
+	pair_reader_t *reader;
+	writer_t *writer;
+	scheme_cache_t *schemes;
+	scheme_t *scheme; // for the pairs being read
+} pipeline_t;
+
+typedef struct {
+	pipeline_t *p;
+	scheme_t *scheme; // the options and library data for every pair in the batch
+	int n_pairs;
+	kstring_t *query_names;
+	kstring_t *queries;
+	kstring_t *target_names;
+	kstring_t *targets;
+	alignment_t *alignments;
+	kstring_t *rev_targets; // only with --strand
+	alignment_t *rev_alignments; // only with --strand
+	int *order; // the pairs ordered by length, so each inter-sequence group has similar lengths
+} batch_t;
+
+static batch_t *batch_read(pipeline_t *p)
+{
+	int m_pairs = 0, ret;
+	kstring_t query_name = {0, 0, 0}, query = {0, 0, 0}, target_name = {0, 0, 0}, target = {0, 0, 0};
+	batch_t *b = calloc(1, sizeof(batch_t));
+	b->p = p;
+	while (b->n_pairs < p->opt->batch_size && (ret = pair_reader_next(p->reader, &query_name, &query, &target_name, &target)) != PairReaderEnd) {
+		if (ret == PairReaderCommand) { // a batch has one scheme, so the pairs after the command start the next batch
+			scheme_t *scheme = scheme_switch(p->schemes, p->scheme, query.s);
+			if (scheme == p->scheme) continue;
+			p->scheme = scheme;
+			if (b->n_pairs > 0) break;
+			continue;
+		}
+		if (b->n_pairs == 0) {
+			b->scheme = p->scheme;
+			scheme_cache_acquire(p->schemes, b->scheme);
+		}
+		if (b->n_pairs == m_pairs) {
+			m_pairs = m_pairs ? m_pairs<<1 : 256;
+			b->query_names = (kstring_t*)realloc(b->query_names, m_pairs*sizeof(kstring_t));
+			b->queries = (kstring_t*)realloc(b->queries, m_pairs*sizeof(kstring_t));
+			b->target_names = (kstring_t*)realloc(b->target_names, m_pairs*sizeof(kstring_t));
+			b->targets = (kstring_t*)realloc(b->targets, m_pairs*sizeof(kstring_t));
+		}
+		// take ownership of the buffers
+		b->query_names[b->n_pairs] = query_name;
+		b->queries[b->n_pairs] = query;
+		b->target_names[b->n_pairs] = target_name;
+		b->targets[b->n_pairs] = target;
+		memset(&query_name, 0, sizeof(kstring_t));
+		memset(&query, 0, sizeof(kstring_t));
+		memset(&target_name, 0, sizeof(kstring_t));
+		memset(&target, 0, sizeof(kstring_t));
+		b->n_pairs++;
+	}
+	kstring_free(&query_name);
+	kstring_free(&query);
+	kstring_free(&target_name);
+	kstring_free(&target);
+	if (b->n_pairs == 0) {
+		free(b->query_names);
+		free(b->queries);
+		free(b->target_names);
+		free(b->targets);
+		free(b);
+		return NULL;
+	}
+	b->alignments = calloc(b->n_pairs, sizeof(alignment_t));
+	if (b->scheme->opt->strand != StrandForward) {
+		b->rev_targets = calloc(b->n_pairs, sizeof(kstring_t));
+		b->rev_alignments = calloc(b->n_pairs, sizeof(alignment_t));
+	}
+	return b;
+}
+
+static void batch_destroy(batch_t *b)
+{
+	int i;
+	for (i = 0; i < b->n_pairs; ++i) {
+		kstring_free(&b->query_names[i]);
+		kstring_free(&b->queries[i]);
+		kstring_free(&b->target_names[i]);
+		kstring_free(&b->targets[i]);
+		free(b->alignments[i].cigar);
+		if (b->rev_targets != NULL) {
+			free(b->rev_targets[i].s);
+			free(b->rev_alignments[i].cigar);
+		}
+	}
+	free(b->query_names);
+	free(b->queries);
+	free(b->target_names);
+	free(b->targets);
+	free(b->alignments);
+	free(b->rev_targets);
+	free(b->rev_alignments);
+	free(b->order);
+	scheme_cache_release(b->p->schemes, b->scheme);
+	free(b);
+}
+
+static void batch_align_worker(void *data, long i, int tid)
+{
+	batch_t *b = (batch_t*)data;
+	align_pair_strands(&b->queries[i], &b->targets[i], b->rev_targets + i, b->scheme->opt, b->scheme->library_data[tid], &b->alignments[i], b->rev_alignments + i);
+}
+
+typedef struct {
+	int target_length, query_length, i;
+} pair_length_t;
+
+static int pair_length_cmp(const void *a, const void *b)
+{
+	const pair_length_t *x = (const pair_length_t*)a, *y = (const pair_length_t*)b;
+	if (x->target_length != y->target_length) return (x->target_length < y->target_length) ? -1 : 1;
+	if (x->query_length != y->query_length) return (x->query_length < y->query_length) ? -1 : 1;
+	return (x->i < y->i) ? -1 : (x->i > y->i);
+}
+
+// Gets the order of the pairs by target then query length, so that pairs of similar lengths are aligned together
+int *pairs_order_by_length(int n, const int *query_lengths, const int *target_lengths)
+{
+	int i, *order = malloc(n * sizeof(int));
+	pair_length_t *lengths = malloc(n * sizeof(pair_length_t));
+	for (i = 0; i < n; ++i) {
+		lengths[i].target_length = target_lengths[i];
+		lengths[i].query_length = query_lengths[i];
+		lengths[i].i = i;
+	}
+	qsort(lengths, n, sizeof(pair_length_t), pair_length_cmp);
+	for (i = 0; i < n; ++i) order[i] = lengths[i].i;
+	free(lengths);
+	return order;
+}
+
+static void batch_order_by_length(batch_t *b)
+{
+	int i;
+	int *query_lengths = malloc(b->n_pairs * sizeof(int)), *target_lengths = malloc(b->n_pairs * sizeof(int));
+	for (i = 0; i < b->n_pairs; ++i) {
+		query_lengths[i] = b->queries[i].l;
+		target_lengths[i] = b->targets[i].l;
+	}
+	b->order = pairs_order_by_length(b->n_pairs, query_lengths, target_lengths);
+	free(query_lengths);
+	free(target_lengths);
+}
+
+// Aligns the i-th group of pairs with the inter-sequence engine, and any it could not align with the library
+static void batch_align_interseq_worker(void *data, long i, int tid)
+{
+	batch_t *b = (batch_t*)data;
+	int k, n = b->n_pairs - i * INTERSEQ_N_LANES;
+	const char *queries[INTERSEQ_N_LANES], *targets[INTERSEQ_N_LANES];
+	int query_lengths[INTERSEQ_N_LANES] = {0}, target_lengths[INTERSEQ_N_LANES] = {0};
+	alignment_t *alignments[INTERSEQ_N_LANES];
+	int failed[INTERSEQ_N_LANES];
+	if (n > INTERSEQ_N_LANES) n = INTERSEQ_N_LANES;
+	for (k = 0; k < n; ++k) {
+		int j = b->order[i * INTERSEQ_N_LANES + k];
+		queries[k] = b->queries[j].s;
+		query_lengths[k] = b->queries[j].l;
+		targets[k] = b->targets[j].s;
+		target_lengths[k] = b->targets[j].l;
+		alignments[k] = &b->alignments[j];
+		alignment_reset(alignments[k]);
+	}
+	if (interseq_align(b->scheme->interseq[tid], n, queries, query_lengths, targets, target_lengths, alignments, failed) == 0) return;
+	for (k = 0; k < n; ++k) {
+		if (failed[k]) align_pair(queries[k], query_lengths[k], targets[k], target_lengths[k], b->scheme->opt, b->scheme->library_data[tid], alignments[k]);
+	}
+}
+
+static void *batch_pipeline(void *shared, int step, void *in)
+{
+	int i;
+	pipeline_t *p = (pipeline_t*)shared;
+	if (step == 0) { // read a batch of pairs
+		return batch_read(p);
+	}
+	else if (step == 1) { // align the batch, each thread using its own library data
+		batch_t *b = (batch_t*)in;
+		if (b->scheme->interseq != NULL) {
+			batch_order_by_length(b);
+			kt_for(p->opt->n_threads, batch_align_interseq_worker, b, (b->n_pairs + INTERSEQ_N_LANES - 1) / INTERSEQ_N_LANES);
+		}
+		else {
+			kt_for(p->opt->n_threads, batch_align_worker, b, b->n_pairs);
+		}
+		return b;
+	}
+	else if (step == 2) { // output in input order
+		batch_t *b = (batch_t*)in;
+		for (i = 0; i < b->n_pairs; ++i) {
+			alignment_print_strands(p->writer, b->query_names[i].s, &b->queries[i], b->target_names[i].s, &b->targets[i],
+					b->rev_targets + i, b->scheme->opt, &b->alignments[i], b->rev_alignments + i);
+			if (p->opt->flush_policy == FlushAlways) writer_flush(p->writer);
+		}
+		// NB: the reader is in use by the first step, so treat the end of each batch as idle
+		writer_maybe_flush(p->writer, 1);
+		batch_destroy(b);
+	}
+	return 0;
+}
+
+void align_batches(pair_reader_t *reader, writer_t *writer, main_opt_t *opt, scheme_cache_t *schemes)
+{
+	pipeline_t p;
+	p.opt = opt;
+	p.reader = reader;
+	p.writer = writer;
+	p.schemes = schemes;
+	p.scheme = scheme_cache_default(schemes);
+
+	// read, align, and write in a three-step pipeline so that I/O overlaps with alignment
+	kt_pipeline(2, batch_pipeline, &p, 3);
+
+	scheme_cache_release(schemes, p.scheme);
 }
 
 /*********/
 /** main */
 /*********/
 
-void usage(main_opt_t *opt)
+// NB: libksw (see ksw.h) has no main
+#ifndef KSW_LIBRARY
+
+// long-only options are past any short option
+#define LongOptListen 256
+#define LongOptStrand 257
+#define LongOptStats  258
+#define LongOptCache  259
+#define LongOptCacheFile 260
+
+// Creates the result cache (--cache), with the entries saved by an earlier run (--cache-file)
+static void main_cache_init(main_opt_t *opt)
+{
+	char err[KSW_ERR_LEN];
+	if (opt->cache_size == 0) return;
+	opt->_cache = result_cache_init((size_t)opt->cache_size << 20);
+	if (opt->cache_fn != NULL) assert_or_exit(result_cache_load(opt->_cache, opt->cache_fn, err) == 0, "%s", err);
+}
+
+// Saves the result cache (--cache-file), writes its hits and misses with -v, and destroys it
+static void main_cache_destroy(main_opt_t *opt)
+{
+	char err[KSW_ERR_LEN];
+	if (opt->_cache == NULL) return;
+	if (opt->cache_fn != NULL) assert_or_exit(result_cache_save(opt->_cache, opt->cache_fn, err) == 0, "%s", err);
+	if (opt->verbose) result_cache_print(opt->_cache, stderr);
+	result_cache_destroy(opt->_cache);
+	opt->_cache = NULL;
+}
+
+void usage(main_opt_t *opt, int stats)
 {
 	int i;
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Program: ksw (klib smith-waterman)\n");
 	fprintf(stderr, "Version: %s\n", GIT_HASH);
-	fprintf(stderr, "Usage: ksw [options]\n\n");
+	fprintf(stderr, "SIMD:    %s (ksw2)\n", ksw2_dispatch_simd_name());
+	fprintf(stderr, "Usage: ksw [options] [<in.fq> [<in2.fq>]]\n");
+	fprintf(stderr, "       ksw bench [options] [<in.fq> [<in2.fq>]]\n\n");
+	fprintf(stderr, "Without files, alternating queries and targets are read one per line from standard input.  With one\n");
+	fprintf(stderr, "FASTA/FASTQ file, queries and targets are interleaved in the file.  With two, queries are read from the\n");
+	fprintf(stderr, "first and targets from the second.  Files may be gzip-compressed, and record names are output first.\n\n");
 	fprintf(stderr, "Algorithm options:\n\n");
 	fprintf(stderr, "       -M INT      The alignment mode:");
 	for (i = AlignmentModeStart; i <= AlignmentModeEnd; ++i) {
@@ -570,11 +1757,15 @@ void usage(main_opt_t *opt)
 	fprintf(stderr, "       -b INT      The mismatch penalty (>0) [%d]\n", opt->mismatch_score);
 	fprintf(stderr, "       -q INT      The gap open penalty (>=0) [%d]\n", opt->gap_open);
 	fprintf(stderr, "       -r INT      The gap extend penalty (>0) [%d]\n", opt->gap_extend);
-	fprintf(stderr, "       -w INT      The band width (ksw only) [%d]\n", opt->band_width);
+	fprintf(stderr, "       -Q INT      The second gap open penalty for a two-piece affine gap model (>=0, ksw only) [%d]\n", opt->gap_open2);
+	fprintf(stderr, "       -E INT      The second gap extend penalty for a two-piece affine gap model (>0 to enable, ksw only) [%d]\n", opt->gap_extend2);
+	fprintf(stderr, "       -w INT      The band width for ksw, and for global with parasail; -1 sizes the band from the difference\n");
+	fprintf(stderr, "                   in lengths [%d]\n", opt->band_width);
 	fprintf(stderr, "       -m FILE     Path to the scoring matrix (4x4 or 5x5) [%s]\n", opt->matrix_fn == NULL ? "None" : opt->matrix_fn);
 	fprintf(stderr, "       -c          Append the cigar to the output [%s]\n", opt->add_cigar == 0 ? "false" : "true");
 	fprintf(stderr, "       -s          Append the query and target to the output [%s]\n", opt->add_seq == 0 ? "false" : "true");
 	fprintf(stderr, "       -H          Add a header line to the output [%s]\n", opt->add_header == 0 ? "false" : "true");
+	fprintf(stderr, "       -S          Find the query and target start for local and glocal without the cigar (parasail only) [%s]\n", opt->find_starts == 0 ? "false" : "true");
 	fprintf(stderr, "       -R          Right-align gaps (ksw only)[%s]\n", opt->right_align_gaps == 0 ? "false" : "true");
 	fprintf(stderr, "       -O          Output offset-and-length, otherwise start-and-end (all zero-based)[%s]\n", opt->offset_and_length == 0 ? "false" : "true");
 	fprintf(stderr, "       -l INT      The library type:");
@@ -583,80 +1774,235 @@ void usage(main_opt_t *opt)
 		if (i < LibraryEnd) fputc(',', stderr);
 	}
 	fprintf(stderr, " [%d - %s]\n", opt->library, library_to_str(opt->library));
-	fprintf(stderr, "       -z INT      Z-drop (for KSW) [%d]\n", opt->zdrop);
+	fprintf(stderr, "       -P FILE     The cost model to choose the library for each pair (-l %d), otherwise it is calibrated at\n", PerPairLibrary);
+	fprintf(stderr, "                   startup and written to standard error with -v [%s]\n", opt->selector_fn == NULL ? "None" : opt->selector_fn);
+	fprintf(stderr, "       -z INT      Z-drop for ksw, and for global with parasail [%d]\n", opt->zdrop);
+	fprintf(stderr, "       -n          Read a query, the number of targets N, then N targets, instead of alternating queries and targets [%s]\n", opt->one_vs_many == 0 ? "false" : "true");
+	fprintf(stderr, "       -W INT      The score width in bits (parasail only): 0 - auto (8, then 16, then 32 on overflow), 8, 16, 32 [%d]\n", opt->parasail_score_width);
+	if (opt->min_score == INT_MIN) fprintf(stderr, "       -T INT      The minimum score; the cigar and -S starts are only found for pairs that reach it [None]\n");
+	else fprintf(stderr, "       -T INT      The minimum score; the cigar and -S starts are only found for pairs that reach it [%d]\n", opt->min_score);
+	fprintf(stderr, "       -D          Do not output pairs below the minimum score (-T), otherwise output them without the cigar [%s]\n", opt->drop_filtered == 0 ? "false" : "true");
+	fprintf(stderr, "       --strand STR\n");
+	fprintf(stderr, "                   Align to the target (forward), or also to its reverse complement and output the better\n");
+	fprintf(stderr, "                   (best) or both (both) with a strand column [%s]\n", strand_to_str(opt->strand));
+	fprintf(stderr, "       -v          Write library statistics (ex. memory usage) to standard error on exit [%s]\n", opt->verbose == 0 ? "false" : "true");
+	fprintf(stderr, "       --stats STR Write the time in each stage, DP cells, GCUPS, and pair lengths to standard error on exit and\n");
+	fprintf(stderr, "                   on SIGUSR1, as off, tsv, or json (needs a build without stats=0) [%s]\n", stats_format_to_str(stats));
+	fprintf(stderr, "       --cache INT Re-use the alignment of a repeated pair, keeping up to INT megabytes of the most recently used\n");
+	fprintf(stderr, "                   pairs and their alignments; 0 to align every pair [%d]\n", opt->cache_size);
+	fprintf(stderr, "       --cache-file FILE\n");
+	fprintf(stderr, "                   Restore the cache (--cache) from the file if it exists, and save it there on exit [%s]\n", opt->cache_fn == NULL ? "None" : opt->cache_fn);
+	fprintf(stderr, "\nBatch options:\n\n");
+	fprintf(stderr, "       -i FILE     Read alternating queries and targets (or -n) from a file, one per line, rather than standard\n");
+	fprintf(stderr, "                   input; a regular file is mapped into memory and aligned without copying [%s]\n", opt->input_fn == NULL ? "None" : opt->input_fn);
+	fprintf(stderr, "       -B          Use the binary framed protocol on standard input and output (see src/binary.h) [%s]\n", opt->binary == 0 ? "false" : "true");
+	fprintf(stderr, "       --listen PATH\n");
+	fprintf(stderr, "                   Serve many clients over a Unix domain socket, with the binary protocol on each connection\n");
+	fprintf(stderr, "                   (see src/server.h) [%s]\n", opt->listen_fn == NULL ? "None" : opt->listen_fn);
+	fprintf(stderr, "       -t INT      The number of threads; more than one reads and aligns pairs in batches [%d]\n", opt->n_threads);
+	fprintf(stderr, "       -K INT      The number of pairs per batch when using more than one thread [%d]\n", opt->batch_size);
+	fprintf(stderr, "       -I          Align the pairs in each batch %d at a time, one per SIMD lane, for short pairs with parasail\n", INTERSEQ_N_LANES);
+	fprintf(stderr, "                   without the cigar (-c) or starts (-S); other pairs are aligned one at a time [%s]\n", opt->inter_seq == 0 ? "false" : "true");
+	fprintf(stderr, "       -F STR      When to flush the output: always, on-idle (when no more input is buffered, or after each\n");
+	fprintf(stderr, "                   batch), or never (when the buffer is full) [%s]\n", flush_policy_to_str(opt->flush_policy));
+	fprintf(stderr,"\nNote: on standard input, a line \"%s <options>\" in place of a query sets -M, -a, -b, -q, -r, -Q, -E, -w, -z,\n", SCHEME_COMMAND);
+	fprintf(stderr,"      -m, or -l, relative to the options above, for the pairs that follow (see src/scheme.h).\n");
 	fprintf(stderr,"\nNote: when any of the algorithms open a gap, the gap open plus the gap extension penalty is applied.\n");
+	fprintf(stderr,"Note: with a two-piece affine gap model, a gap of length k costs min(q+k*r, Q+k*E).\n");
 }
 
 int main(int argc, char *argv[])
 {
 	main_opt_t * opt = NULL;
-	int c;
+	int c, ret, stats = StatsOff;
+	int32_t library;
+	char err[KSW_ERR_LEN];
+	static struct option long_options[] = {
+		{ "listen", required_argument, NULL, LongOptListen },
+		{ "strand", required_argument, NULL, LongOptStrand },
+		{ "stats", required_argument, NULL, LongOptStats },
+		{ "cache", required_argument, NULL, LongOptCache },
+		{ "cache-file", required_argument, NULL, LongOptCacheFile },
+		{ NULL, 0, NULL, 0 }
+	};
 	alignment_t *alignment = alignment_init();
 
+	// the benchmark has its own options
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		alignment_destroy(alignment);
+		return main_bench(argc - 1, argv + 1);
+	}
+
 	opt = main_opt_init();
 
-	// FIXME: for local or glocal we don't know the query/target starts unless we output the cigar
-	while ((c = getopt(argc, argv, "M:a:b:q:r:w:m:csHROz:l:h")) >= 0) {
+	// NB: for local or glocal we only know the query/target starts if we output the cigar (-c) or find them (-S)
+	while ((c = getopt_long(argc, argv, "M:a:b:q:r:Q:E:w:m:csSHROz:l:P:nW:vBi:t:K:F:T:DIh", long_options, NULL)) >= 0) {
 		switch (c) {
 			case 'M': opt->alignment_mode = atoi(optarg); break;
 			case 'a': opt->match_score = atoi(optarg); break;
 			case 'b': opt->mismatch_score = atoi(optarg); break;
 			case 'q': opt->gap_open = atoi(optarg); break;
 			case 'r': opt->gap_extend = atoi(optarg); break;
+			case 'Q': opt->gap_open2 = atoi(optarg); break;
+			case 'E': opt->gap_extend2 = atoi(optarg); break;
 			case 'w': opt->band_width = atoi(optarg); break;
 			case 'm': opt->matrix_fn = optarg; break; 
 			case 'c': opt->add_cigar = 1; break;
 			case 's': opt->add_seq = 1; break;
+			case 'S': opt->find_starts = 1; break;
 			case 'H': opt->add_header = 1; break;
 			case 'R': opt->right_align_gaps = 1; break;
 			case 'O': opt->offset_and_length = 1; break;
 			case 'z': opt->zdrop = atoi(optarg); break;
 			case 'l': opt->library = atoi(optarg); break;
-			case 'h': usage(opt); return 1;
-			default: usage(opt); return 1;
+			case 'P': opt->selector_fn = optarg; break;
+			case 'n': opt->one_vs_many = 1; break;
+			case 'W': opt->parasail_score_width = atoi(optarg); break;
+			case 'v': opt->verbose = 1; break;
+			case 'B': opt->binary = 1; break;
+			case 'i': opt->input_fn = optarg; break;
+			case LongOptListen: opt->listen_fn = optarg; break;
+			case LongOptStrand:
+				opt->strand = strand_from_str(optarg);
+				assert_or_exit(opt->strand >= 0, "Strand (--strand) must be forward, best, or both, found '%s'.", optarg);
+				break;
+			case LongOptStats:
+				stats = stats_format_from_str(optarg);
+				assert_or_exit(stats >= 0, "Statistics (--stats) must be off, tsv, or json, found '%s'.", optarg);
+#ifndef KSW_STATS
+				assert_or_exit(stats == StatsOff, "Statistics (--stats) were not compiled in, build without stats=0.");
+#endif
+				break;
+			case LongOptCache: opt->cache_size = atoi(optarg); break;
+			case LongOptCacheFile: opt->cache_fn = optarg; break;
+			case 't': opt->n_threads = atoi(optarg); break;
+			case 'K': opt->batch_size = atoi(optarg); break;
+			case 'T': opt->min_score = atoi(optarg); break;
+			case 'D': opt->drop_filtered = 1; break;
+			case 'I': opt->inter_seq = 1; break;
+			case 'F': 
+				opt->flush_policy = flush_policy_from_str(optarg);
+				assert_or_exit(opt->flush_policy >= 0, "Flush policy (-F) must be always, on-idle, or never, found '%s'.", optarg);
+				break;
+			case 'h': usage(opt, stats); return 1;
+			default: usage(opt, stats); return 1;
 		}
 	}
-	if (optind > argc) {
-		usage(opt);
+	if (optind + 2 < argc) {
+		usage(opt, stats);
 		return 1;
 	}
+	if (optind < argc) opt->query_fn = argv[optind];
+	if (optind + 1 < argc) opt->target_fn = argv[optind + 1];
 
 	// validate args
 	main_opt_validate(opt);
 	
-	// set the library data **after** setting the scoring matrix
+	// set the library data **after** setting the scoring matrix, keeping the library as given for any scheme (-l)
+	library = opt->library;
 	main_opt_init_library(opt);
+	main_cache_init(opt);
+
+#ifdef KSW_STATS
+	// start counting after calibrating any cost model (-l 3), and before creating any thread
+	if (stats != StatsOff) stats_init(stats);
+#endif
+
+	// serve clients until stopped, rather than reading standard input
+	if (opt->listen_fn != NULL) {
+		void **library_data = main_opt_thread_data_init(opt, err);
+		assert_or_exit(library_data != NULL, "%s", err);
+		ret = serve(opt->listen_fn, opt, library_data);
+		main_opt_thread_data_destroy(opt, library_data);
+		main_cache_destroy(opt);
+		STATS_REPORT(stderr);
+		alignment_destroy(alignment);
+		main_opt_destroy(opt);
+		return ret;
+	}
+
+	// the binary protocol has no header, and reads frames rather than lines
+	if (opt->binary) {
+		void **library_data = main_opt_thread_data_init(opt, err);
+		assert_or_exit(library_data != NULL, "%s", err);
+		align_binary(fileno(stdin), stdout, opt, library_data);
+		main_opt_thread_data_destroy(opt, library_data);
+		main_cache_destroy(opt);
+		STATS_REPORT(stderr);
+		alignment_destroy(alignment);
+		main_opt_destroy(opt);
+		return 0;
+	}
+
+	writer_t *writer = writer_init(fileno(stdout), opt->flush_policy);
 
 	// output the header
 	if (opt->add_header) {
+		// the names of the records if reading FASTA/FASTQ
+		if (opt->query_fn != NULL) writer_puts(writer, "query_name\ttarget_name\t");
 		// based output format
-		if (opt->offset_and_length == 1) fprintf(stdout, "score\tquery_offset\tquery_length\ttarget_offset\ttarget_length");
-		else fprintf(stdout, "score\tquery_start\tquery_end\ttarget_start\ttarget_end");
+		if (opt->offset_and_length == 1) writer_puts(writer, "score\tquery_offset\tquery_length\ttarget_offset\ttarget_length");
+		else writer_puts(writer, "score\tquery_start\tquery_end\ttarget_start\ttarget_end");
+		// the strand of the target
+		if (opt->strand != StrandForward) writer_puts(writer, "\tstrand");
 		// append the cigar
-		if (opt->add_cigar == 1) fprintf(stdout, "\tcigar");
+		if (opt->add_cigar == 1) writer_puts(writer, "\tcigar");
 		// append the query and target sequence
-		if (opt->add_seq) fprintf(stdout, "\tquery\ttarget");
-		fputc('\n', stdout);
+		if (opt->add_seq) writer_puts(writer, "\tquery\ttarget");
+		writer_putc(writer, '\n');
 	}
 
 	// read a query and target at a time
 	kstream_t *fp     = ks_init(fileno(stdin));
+	pair_reader_t *reader;
+	if (opt->query_fn != NULL) reader = pair_reader_init_fastx(opt->query_fn, opt->target_fn);
+	else if (opt->input_fn != NULL) reader = pair_reader_init_file(opt->input_fn, opt->one_vs_many);
+	else reader = pair_reader_init(fp, opt->one_vs_many);
+	kstring_t *query_name  = (kstring_t*)calloc(1, sizeof(kstring_t));
 	kstring_t *query  = (kstring_t*)calloc(1, sizeof(kstring_t));
+	kstring_t *target_name  = (kstring_t*)calloc(1, sizeof(kstring_t));
 	kstring_t *target = (kstring_t*)calloc(1, sizeof(kstring_t));
-	int retval = 0;
-	while (ks_getuntil(fp, 0, query, &retval) > 0 && ks_getuntil(fp, 0, target, &retval) > 0) {
-		align(query->s, target->s, opt, alignment);
+	kstring_t *rev_target = (kstring_t*)calloc(1, sizeof(kstring_t)); // with --strand
+	alignment_t *rev_alignment = alignment_init();
+	scheme_cache_t *schemes = scheme_cache_init(opt, library, err);
+	assert_or_exit(schemes != NULL, "%s", err);
+	if (opt->n_threads > 1 || opt->inter_seq) {
+		align_batches(reader, writer, opt, schemes);
+	}
+	else {
+		scheme_t *scheme = scheme_cache_default(schemes);
+		while ((ret = pair_reader_next(reader, query_name, query, target_name, target)) != PairReaderEnd) {
+			if (ret == PairReaderCommand) {
+				scheme = scheme_switch(schemes, scheme, query->s);
+			}
+			else align(writer, query_name->s, query, target_name->s, target, rev_target, scheme->opt, alignment, rev_alignment);
+			writer_maybe_flush(writer, pair_reader_is_idle(reader));
+		}
+		scheme_cache_release(schemes, scheme);
 	}
-	free(query->s);
+	scheme_cache_destroy(schemes);
+	pair_reader_destroy(reader);
+	kstring_free(query_name);
+	free(query_name);
+	kstring_free(query);
 	free(query);
-	free(target->s);
+	kstring_free(target_name);
+	free(target_name);
+	kstring_free(target);
 	free(target);
+	free(rev_target->s);
+	free(rev_target);
 	ks_destroy(fp);
 
 	// clean up
+	writer_destroy(writer);
+	main_cache_destroy(opt);
+	STATS_REPORT(stderr);
 	alignment_destroy(alignment);
+	alignment_destroy(rev_alignment);
 	main_opt_destroy(opt);
 
 	return 0;
 }
 
+#endif
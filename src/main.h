@@ -1,36 +1,88 @@
 #ifndef __MAIN_H
 #define __MAIN_H
 
+#include "ksw.h" // alignment_t and KSW_ERR_LEN
+
+enum Library {
+	LibraryStart   = 0,
+	AutoLibrary    = 0,
+	Ksw2           = 1,
+	Parasail       = 2,
+	PerPairLibrary = 3, // chosen for each pair, see selector.h
+	LibraryEnd     = 3,
+};
+
+enum ScoreWidth {
+	AutoScoreWidth = 0,
+	ScoreWidth8    = 8,
+	ScoreWidth16   = 16,
+	ScoreWidth32   = 32,
+};
+
+enum AlignmentMode {
+	AlignmentModeStart = 0,
+	Local              = 0,
+	Glocal             = 1,
+	Extension          = 2,
+	Global             = 3,
+	AlignmentModeEnd   = 3,
+};
+
+// the strands of the target to align the query to (--strand)
+enum Strand {
+	StrandStart   = 0,
+	StrandForward = 0,
+	StrandBest    = 1, // both, reporting the strand with the better score
+	StrandBoth    = 2, // both, reporting each
+	StrandEnd     = 2,
+};
+
+// the band width (-w) when not banded, divided by four since in some places we multiply by two
+#define FullBandWidth (INT_MAX / 4)
+// the band width (-w) that sizes the band for each pair from the difference in the query and target lengths
+#define AutoBandWidth -1
+
+// Sets the error and returns -1 from the calling function if the condition does not hold
+#define check_or_return(err, condition, ...) do { if (!(condition)) return set_error(err, __VA_ARGS__); } while (0)
+
 typedef struct {
 	int8_t *matrix;
 	int ksw2_flags;
 	ksw_extz_t ez;
-	void *km;
+	void *km; // kalloc arena, re-used across alignments
+	size_t km_peak_capacity;
+	int km_n_resets;
+	uint8_t *buf; // scratch space for sequences
+	int m_buf;
+	char *query; // the last query, and its integer format, re-used while the query is unchanged
+	uint8_t *query_nt4;
+	int query_length;
+	int m_query;
 } ksw2_data_t;
 
 typedef struct {
 	parasail_matrix_t *matrix;
-	parasail_function_t *func;
+	int n_funcs;
+	int score_widths[3]; // in increasing order
+	parasail_function_t *funcs[3]; // one per score width, retried with the next when the score saturates
+	parasail_pfunction_t *pfuncs[3]; // the query profile variant of funcs, or NULL if not available
+	parasail_pcreator_t *pcreators[3];
+	parasail_profile_t *profiles[3]; // query profiles, re-used while the query is unchanged
+	parasail_function_t *score_funcs[3]; // score-only variants of funcs to filter by the minimum score, or NULL
+	parasail_pfunction_t *score_pfuncs[3];
+	char *profile_query;
+	int profile_query_length;
+	int profile_query_max_length;
 	parasail_function_t *func_global; // needed for glocal
+	ksw2_data_t *ksw2_data; // used to find the alignment start without a traceback
 } parasail_data_t;
 
 typedef struct main_opt_t main_opt_t;
 
-typedef struct {
-	int score;
-	int qlb;
-	int tlb;
-	int qle;
-	int tle;
-	uint32_t *cigar;
-	int n_cigar;
-	int m_cigar;
-} alignment_t;
-
 typedef void alignment_function_t(
-		char *query, 
+		const char *query, 
 		int query_length, 
-		char *target, 
+		const char *target, 
 		int target_length, 
 		main_opt_t *opt, 
 		void *library_data, 
@@ -41,6 +93,8 @@ struct main_opt_t {
 	int32_t mismatch_score;
 	int32_t gap_open;
 	int32_t gap_extend;
+	int32_t gap_open2;
+	int32_t gap_extend2;
 	int32_t band_width;
 	char *matrix_fn;
 	int32_t alignment_mode;
@@ -53,13 +107,66 @@ struct main_opt_t {
 	int32_t library;
 
 	int32_t parasail_vec_strat;
+	int32_t parasail_score_width;
+	int32_t one_vs_many;
+	int32_t verbose;
+	int32_t find_starts;
+	int32_t binary;
+	int32_t strand;
+	char *listen_fn; // the Unix domain socket to serve clients on (--listen), or NULL for standard input and output
+	char *input_fn; // alternating queries and targets (-i), as on standard input, or NULL
+	char *query_fn; // FASTA/FASTQ with the queries, or interleaved queries and targets
+	char *target_fn; // FASTA/FASTQ with the targets
+
+	int32_t n_threads;
+	int32_t batch_size;
+	int32_t flush_policy;
+	int32_t min_score; // INT_MIN to output all pairs
+	int32_t drop_filtered;
+	int32_t inter_seq;
+	char *selector_fn; // the cost model for the per-pair library, or NULL to calibrate it
+	int32_t cache_size; // the memory for the result cache in megabytes (--cache), or zero for none
+	char *cache_fn; // where the result cache is restored from and saved to (--cache-file), or NULL
 
 	// hidden
+	int8_t _matrix[25];
 	alignment_function_t *_library_func;
 	void *_library_data;
+	struct selector_model_t *_selector_model; // only for the per-pair library
+	struct result_cache_t *_cache; // shared by all threads and schemes, or NULL without --cache
 };
 
-void align_with_ksw2(char *query, int query_length, char *target, int target_length, main_opt_t *opt, void* library_data, alignment_t *alignment);
-void align_with_parasail(char *query, int query_length, char *target, int target_length, main_opt_t *opt, void *library_data, alignment_t *alignment);
+main_opt_t *main_opt_init();
+int main_opt_check(const main_opt_t *opt, char *err);
+void main_opt_validate(main_opt_t *opt);
+int main_opt_prepare(main_opt_t *opt, char *err);
+void main_opt_init_library(main_opt_t *opt);
+void *main_opt_library_data_init(main_opt_t *opt, char *err);
+void main_opt_library_data_destroy(main_opt_t *opt, void *library_data);
+void **main_opt_thread_data_init(main_opt_t *opt, char *err);
+void main_opt_thread_data_destroy(main_opt_t *opt, void **library_data);
+void main_opt_destroy(main_opt_t *opt);
+void assert_or_exit(int condition, const char *fmt, ...);
+int set_error(char *err, const char *fmt, ...);
+char *alignment_mode_to_str(int mode);
+char *library_to_str(int mode);
+const char *strand_to_str(int strand);
+int strand_from_str(const char *str);
+
+ksw2_data_t *ksw2_data_init(main_opt_t *opt, const int8_t *matrix);
+void ksw2_data_print_stats(FILE *fp, const ksw2_data_t *data);
+void ksw2_data_destroy(ksw2_data_t *data);
+parasail_data_t *parasail_data_init(main_opt_t *opt, const int8_t *matrix, int vec_strategy, char *err);
+void parasail_data_destroy(parasail_data_t *data);
+
+void alignment_reset(alignment_t *a);
+// Copies the score, coordinates, and cigar, but not the strand
+void alignment_copy(alignment_t *dst, const alignment_t *src);
+void align_pair(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, void *library_data, alignment_t *alignment);
+int pair_band_width(const main_opt_t *opt, int query_length, int target_length);
+int *pairs_order_by_length(int n, const int *query_lengths, const int *target_lengths);
+
+void align_with_ksw2(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, void* library_data, alignment_t *alignment);
+void align_with_parasail(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, void *library_data, alignment_t *alignment);
 
 #endif
@@ -0,0 +1,97 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapped.h"
+
+struct mapped_file_t {
+	const char *data;
+	size_t size;
+	size_t offset; // the start of the next token or line
+};
+
+mapped_file_t *mapped_file_init(int fd)
+{
+	struct stat st;
+	void *data;
+	mapped_file_t *m;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) return NULL;
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) return NULL;
+	madvise(data, st.st_size, MADV_SEQUENTIAL); // read ahead aggressively, and drop pages once read
+	m = calloc(1, sizeof(mapped_file_t));
+	m->data = (const char*)data;
+	m->size = st.st_size;
+	return m;
+}
+
+// Checks the length of a line or token fits in an int, as a kstring's does not
+static void mapped_file_check_length(size_t n)
+{
+	if (n > INT_MAX) {
+		fprintf(stderr, "Error: a line in the input is longer than %d bytes\n", INT_MAX);
+		exit(1);
+	}
+}
+
+int mapped_file_next_token(mapped_file_t *m, const char **token, int *length, int *delimiter)
+{
+	size_t i;
+	if (m->offset >= m->size) return 0;
+	*token = m->data + m->offset;
+	for (i = m->offset; i < m->size; ++i) if (isspace((unsigned char)m->data[i])) break;
+	mapped_file_check_length(i - m->offset);
+	*length = (int)(i - m->offset);
+	*delimiter = (i < m->size) ? (unsigned char)m->data[i] : 0;
+	m->offset = i + 1;
+	return 1;
+}
+
+int mapped_file_next_line(mapped_file_t *m, const char **line, int *length)
+{
+	const char *end;
+	size_t n;
+	if (m->offset >= m->size) return 0;
+	*line = m->data + m->offset;
+	end = (const char*)memchr(*line, '\n', m->size - m->offset);
+	n = (end == NULL) ? m->size - m->offset : (size_t)(end - *line);
+	mapped_file_check_length(n);
+	m->offset += n + 1;
+	if (n > 1 && (*line)[n - 1] == '\r') --n;
+	*length = (int)n;
+	return 1;
+}
+
+void mapped_file_destroy(mapped_file_t *m)
+{
+	munmap((void*)m->data, m->size);
+	free(m);
+}
@@ -0,0 +1,26 @@
+#ifndef __MAPPED_H
+#define __MAPPED_H
+
+/* Reads the tokens and lines of a file mapped into memory (-i), each as a pointer into the mapping and a length, so
+ * nothing is copied.  Tokens are split as ks_getuntil() splits standard input, so both read the same pairs.  Only
+ * regular files can be mapped, so the caller falls back to plain reads for anything else, such as a pipe.
+ */
+
+typedef struct mapped_file_t mapped_file_t;
+
+// Maps the file open on fd, which stays open until destroyed.  Returns NULL if it cannot be mapped, as it is not a
+// regular file, or is empty.
+mapped_file_t *mapped_file_init(int fd);
+
+// Gets the next token, up to the next whitespace character (isspace), valid until destroyed, as ks_getuntil() with
+// KS_SEP_SPACE: the token is empty between two whitespace characters.  The whitespace character that ended the token,
+// or zero at the end of the file, is put in delimiter.  Returns 1 if a token was read, 0 at the end of the file.
+int mapped_file_next_token(mapped_file_t *m, const char **token, int *length, int *delimiter);
+
+// Gets the rest of the line, without the '\n' (or "\r\n"), valid until destroyed, as ks_getuntil() with KS_SEP_LINE.
+// Returns 1 if a line was read, 0 at the end of the file.
+int mapped_file_next_line(mapped_file_t *m, const char **line, int *length);
+
+void mapped_file_destroy(mapped_file_t *m);
+
+#endif
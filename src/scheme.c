@@ -0,0 +1,274 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ksw2/kalloc.h"
+#include "ksw2/ksw2.h"
+#include "parasail/parasail.h"
+#include "main.h"
+#include "interseq.h"
+#include "scheme.h"
+
+struct scheme_cache_t {
+	main_opt_t *opt; // the startup options
+	scheme_t **schemes; // the first is the startup scheme
+	int n, m;
+	uint64_t clock;
+	pthread_mutex_t mutex; // the schemes are taken when reading a batch, but released after writing it (-t)
+};
+
+/************/
+/* scheme_t */
+/************/
+
+// Returns NULL, with the message in err, if the library data cannot be created
+static scheme_t *scheme_init(main_opt_t *opt, int32_t library, char *err)
+{
+	int i;
+	scheme_t *s;
+	if (opt->_library_data == NULL && (opt->_library_data = main_opt_library_data_init(opt, err)) == NULL) return NULL;
+	s = calloc(1, sizeof(scheme_t));
+	s->opt = opt;
+	s->library = library;
+	if ((s->library_data = main_opt_thread_data_init(opt, err)) == NULL) {
+		free(s);
+		return NULL;
+	}
+	if (opt->inter_seq && interseq_is_supported(opt)) {
+		s->interseq = calloc(opt->n_threads, sizeof(interseq_t*));
+		for (i = 0; i < opt->n_threads; ++i) s->interseq[i] = interseq_init(opt);
+	}
+	else if (opt->inter_seq && opt->verbose) {
+		fprintf(stderr, "[interseq] not supported with these options, aligning one pair at a time\n");
+	}
+	return s;
+}
+
+// Destroys the scheme, and its options unless they are the startup options
+static void scheme_destroy(scheme_t *s, int owns_opt)
+{
+	int i;
+	if (s->interseq != NULL) {
+		for (i = 0; i < s->opt->n_threads; ++i) interseq_destroy(s->interseq[i]);
+		free(s->interseq);
+	}
+	main_opt_thread_data_destroy(s->opt, s->library_data);
+	if (owns_opt) main_opt_destroy(s->opt);
+	free(s->matrix_fn);
+	free(s);
+}
+
+static inline int str_eq(const char *a, const char *b)
+{
+	return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
+}
+
+// Whether the scheme was built with the options that a command may set
+static int scheme_matches(const scheme_t *s, const main_opt_t *opt, int32_t library)
+{
+	const main_opt_t *o = s->opt;
+	return s->library == library && o->alignment_mode == opt->alignment_mode
+		&& o->match_score == opt->match_score && o->mismatch_score == opt->mismatch_score
+		&& o->gap_open == opt->gap_open && o->gap_extend == opt->gap_extend
+		&& o->gap_open2 == opt->gap_open2 && o->gap_extend2 == opt->gap_extend2
+		&& o->band_width == opt->band_width && o->zdrop == opt->zdrop && str_eq(o->matrix_fn, opt->matrix_fn);
+}
+
+// Sets the options from a command line, starting from the startup options.  Returns non-zero, with the message in
+// err, if it is malformed.
+static int scheme_parse(const char *line, main_opt_t *opt, int32_t *library, char *err)
+{
+	char *buf = strdup(line), *saveptr = NULL, *flag, *value, *end;
+	int ret = 0;
+
+	flag = strtok_r(buf, " \t\r\n", &saveptr);
+	if (flag == NULL || strcmp(flag, SCHEME_COMMAND) != 0) {
+		ret = set_error(err, "Unknown command: %s", line);
+		goto end;
+	}
+	while ((flag = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+		long x = 0;
+		if (flag[0] != '-' || flag[1] == '\0' || flag[2] != '\0' || (value = strtok_r(NULL, " \t\r\n", &saveptr)) == NULL) {
+			ret = set_error(err, "Expected an option and its value in '%s', found '%s'.", line, flag);
+			goto end;
+		}
+		if (flag[1] != 'm') {
+			errno = 0;
+			x = strtol(value, &end, 10);
+			if (*end != '\0' || errno != 0 || x < INT32_MIN || x > INT32_MAX) {
+				ret = set_error(err, "Expected an integer for %s in '%s', found '%s'.", flag, line, value);
+				goto end;
+			}
+		}
+		switch (flag[1]) {
+			case 'M': opt->alignment_mode = x; break;
+			case 'a': opt->match_score = x; break;
+			case 'b': opt->mismatch_score = x; break;
+			case 'q': opt->gap_open = x; break;
+			case 'r': opt->gap_extend = x; break;
+			case 'Q': opt->gap_open2 = x; break;
+			case 'E': opt->gap_extend2 = x; break;
+			case 'w': opt->band_width = x; break;
+			case 'z': opt->zdrop = x; break;
+			case 'l': *library = x; break;
+			case 'm':
+				free(opt->matrix_fn);
+				opt->matrix_fn = strdup(value);
+				break;
+			default:
+				ret = set_error(err, "Option %s cannot be set in '%s'; only -M, -a, -b, -q, -r, -Q, -E, -w, -z, -m, and -l can be.", flag, line);
+				goto end;
+		}
+	}
+end:
+	free(buf);
+	return ret;
+}
+
+/******************/
+/* scheme_cache_t */
+/******************/
+
+scheme_cache_t *scheme_cache_init(main_opt_t *opt, int32_t library, char *err)
+{
+	scheme_t *s = scheme_init(opt, library, err);
+	if (s == NULL) return NULL;
+	scheme_cache_t *cache = calloc(1, sizeof(scheme_cache_t));
+	cache->opt = opt;
+	cache->m = SCHEME_CACHE_SIZE;
+	cache->schemes = calloc(cache->m, sizeof(scheme_t*));
+	cache->schemes[cache->n++] = s;
+	pthread_mutex_init(&cache->mutex, 0);
+	return cache;
+}
+
+void scheme_cache_destroy(scheme_cache_t *cache)
+{
+	int i;
+	for (i = 0; i < cache->n; ++i) scheme_destroy(cache->schemes[i], i > 0);
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache->schemes);
+	free(cache);
+}
+
+scheme_t *scheme_cache_default(scheme_cache_t *cache)
+{
+	scheme_cache_acquire(cache, cache->schemes[0]);
+	return cache->schemes[0];
+}
+
+scheme_t *scheme_cache_get(scheme_cache_t *cache, const char *line, char *err)
+{
+	int i, lru = -1;
+	main_opt_t *opt;
+	int32_t library;
+	scheme_t *s = NULL;
+
+	// the options of the command, starting from the startup options
+	opt = malloc(sizeof(main_opt_t));
+	*opt = *cache->opt;
+	opt->matrix_fn = (cache->opt->matrix_fn != NULL) ? strdup(cache->opt->matrix_fn) : NULL; // owned by the scheme
+	opt->_library_data = NULL;
+	opt->_selector_model = NULL;
+	library = cache->schemes[0]->library;
+	if (scheme_parse(line, opt, &library, err) != 0) {
+		free(opt->matrix_fn);
+		free(opt);
+		return NULL;
+	}
+
+	// re-use a cached scheme
+	pthread_mutex_lock(&cache->mutex);
+	for (i = 0; i < cache->n; ++i) {
+		if (scheme_matches(cache->schemes[i], opt, library)) {
+			s = cache->schemes[i];
+			s->n_refs++;
+			s->last_used = ++cache->clock;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	if (s != NULL) {
+		free(opt->matrix_fn);
+		free(opt);
+		return s;
+	}
+
+	// build the scheme, as at startup
+	opt->library = library;
+	if (main_opt_check(opt, err) != 0 || main_opt_prepare(opt, err) != 0) {
+		free(opt->matrix_fn);
+		opt->matrix_fn = NULL;
+		main_opt_destroy(opt);
+		return NULL;
+	}
+	if ((s = scheme_init(opt, library, err)) == NULL) {
+		free(opt->matrix_fn);
+		opt->matrix_fn = NULL;
+		main_opt_destroy(opt);
+		return NULL;
+	}
+	s->matrix_fn = opt->matrix_fn;
+	s->n_refs = 1;
+
+	// evict the least recently used scheme that is not in use, if the cache is full
+	pthread_mutex_lock(&cache->mutex);
+	s->last_used = ++cache->clock;
+	if (cache->n == cache->m) {
+		for (i = 1; i < cache->n; ++i) {
+			if (cache->schemes[i]->n_refs == 0 && (lru < 0 || cache->schemes[i]->last_used < cache->schemes[lru]->last_used)) lru = i;
+		}
+		if (lru < 0) { // all are in use, so grow
+			cache->m <<= 1;
+			cache->schemes = realloc(cache->schemes, cache->m * sizeof(scheme_t*));
+		}
+		else {
+			scheme_destroy(cache->schemes[lru], 1);
+			cache->schemes[lru] = cache->schemes[--cache->n];
+		}
+	}
+	cache->schemes[cache->n++] = s;
+	pthread_mutex_unlock(&cache->mutex);
+	return s;
+}
+
+void scheme_cache_acquire(scheme_cache_t *cache, scheme_t *scheme)
+{
+	pthread_mutex_lock(&cache->mutex);
+	scheme->n_refs++;
+	scheme->last_used = ++cache->clock;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+void scheme_cache_release(scheme_cache_t *cache, scheme_t *scheme)
+{
+	pthread_mutex_lock(&cache->mutex);
+	scheme->n_refs--;
+	pthread_mutex_unlock(&cache->mutex);
+}
@@ -0,0 +1,51 @@
+#ifndef __SCHEME_H
+#define __SCHEME_H
+
+/* Scoring schemes that are switched in-band on standard input, without restarting the process.
+ *
+ * A line starting with SCHEME_COMMAND, in place of a query, sets the alignment mode, scoring, band width, z-drop, or
+ * library for the pairs that follow, with the same options as on the command line (-M, -a, -b, -q, -r, -Q, -E, -w, -z,
+ * -m, and -l), for example "#set -M 1 -a 2 -b 4".  The options are relative to those given at startup, so a line with
+ * no options switches back to the startup scheme.  The line has no output.
+ *
+ * Each scheme holds its own options, scoring matrix, and library data (including parasail's functions and profiles)
+ * for each thread, so building one is as costly as starting up.  The most recently used schemes are kept in a small
+ * cache, so switching between a few schemes only builds each once.
+ */
+
+#define SCHEME_COMMAND        "#set"
+#define SCHEME_CACHE_SIZE     8
+
+typedef struct {
+	main_opt_t *opt; // the options, matrix, and library data (for the first thread) of this scheme
+	void **library_data; // one per thread (opt->n_threads)
+	interseq_t **interseq; // one per thread, or NULL if not using the inter-sequence engine (-I)
+	// private
+	char *matrix_fn;
+	int32_t library; // as given, before choosing the library for the alignment mode
+	int n_refs;
+	uint64_t last_used;
+} scheme_t;
+
+typedef struct scheme_cache_t scheme_cache_t;
+
+// Creates the cache with the startup scheme, using the prepared options and the library as given on the command line.
+// The startup scheme is never evicted, and does not own opt.  Returns NULL, with the message in err, on error.
+scheme_cache_t *scheme_cache_init(main_opt_t *opt, int32_t library, char *err);
+
+void scheme_cache_destroy(scheme_cache_t *cache);
+
+// Returns the startup scheme, which must be released
+scheme_t *scheme_cache_default(scheme_cache_t *cache);
+
+// Returns the scheme for a SCHEME_COMMAND line, building it if it is not cached, which must be released.  Returns
+// NULL, with the message in err, if the line is malformed or the options are not valid.
+scheme_t *scheme_cache_get(scheme_cache_t *cache, const char *line, char *err);
+
+// Adds a reference to a scheme returned by the cache, which must also be released
+void scheme_cache_acquire(scheme_cache_t *cache, scheme_t *scheme);
+
+// Releases a scheme returned by the cache, so that it may be evicted once unused
+void scheme_cache_release(scheme_cache_t *cache, scheme_t *scheme);
+
+#endif
@@ -0,0 +1,372 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "ksw2/kseq.h"
+#include "ksw2/ksw2.h"
+#include "parasail/parasail.h"
+#include "main.h"
+#include "selector.h"
+
+// the parasail vectorization strategies (see parasail_to_func_name)
+static const char *selector_vec_strat_names[] = { "striped", "scan", "diag" };
+#define SELECTOR_N_VEC_STRATS 3
+
+// the most choices in a model, which is also the most lines in a model file
+#define SELECTOR_MAX_CHOICES 64
+
+// calibration times lengths doubling from the first to the last, where longer pairs use the choice for the last
+#define SELECTOR_MIN_LENGTH 32
+#define SELECTOR_MAX_LENGTH 2048
+// the number of distinct pairs simulated for each length, so the query profile is rebuilt as it would be for new pairs
+#define SELECTOR_N_PAIRS 8
+// the fewest cells aligned with each library for each length, so that short pairs are timed over many alignments
+#define SELECTOR_MIN_CELLS (1 << 20)
+
+typedef struct {
+	int max_length; // the longest pair (the longer of the query and target) for this choice
+	int library; // Ksw2 or Parasail
+	int vec_strategy; // parasail only
+} selector_choice_t;
+
+struct selector_model_t {
+	int n;
+	selector_choice_t choices[SELECTOR_MAX_CHOICES];
+};
+
+struct selector_data_t {
+	const selector_model_t *model;
+	ksw2_data_t *ksw2_data; // NULL if no choice uses ksw2
+	parasail_data_t *parasail_data[SELECTOR_N_VEC_STRATS]; // NULL for the strategies no choice uses
+	int with_parasail; // non-zero if parasail supports the options, even if no choice uses it
+};
+
+/**************/
+/* candidates */
+/**************/
+
+// Gets the libraries (and vectorization strategies) that support the options, as in main_opt_validate.  Returns the
+// number of candidates.
+static int selector_candidates(const main_opt_t *opt, selector_choice_t *candidates)
+{
+	int i, n = 0;
+	// parasail has no extension, two-piece gaps, right-aligned gaps, and only global uses the band (with ksw2)
+	int use_parasail = opt->alignment_mode != Extension && opt->gap_extend2 == 0 && opt->right_align_gaps == 0;
+	if (opt->alignment_mode == Global && (opt->band_width != FullBandWidth || opt->zdrop >= 0)) use_parasail = 0;
+	// ksw2 and parasail may place gaps differently, so a global cigar is only found with parasail (as with -l 0) when it
+	// supports the options, so that the cigar does not depend on the model
+	int use_ksw2 = opt->alignment_mode == Extension || (opt->alignment_mode == Global && !(use_parasail && opt->add_cigar == 1));
+	if (use_ksw2) {
+		candidates[n].library = Ksw2;
+		candidates[n++].vec_strategy = 0;
+	}
+	if (use_parasail) {
+		for (i = 0; i < SELECTOR_N_VEC_STRATS; ++i) {
+			candidates[n].library = Parasail;
+			candidates[n++].vec_strategy = i;
+		}
+	}
+	return n;
+}
+
+static int selector_is_candidate(const main_opt_t *opt, const selector_choice_t *choice)
+{
+	selector_choice_t candidates[1 + SELECTOR_N_VEC_STRATS];
+	int i, n = selector_candidates(opt, candidates);
+	for (i = 0; i < n; ++i) {
+		if (candidates[i].library == choice->library && candidates[i].vec_strategy == choice->vec_strategy) return 1;
+	}
+	return 0;
+}
+
+/*******************/
+/* selector_data_t */
+/*******************/
+
+// Returns NULL, with the message in err, if the library data for a choice cannot be created
+static selector_data_t *selector_data_init_choices(main_opt_t *opt, const selector_model_t *model, const selector_choice_t *choices, int n, char *err)
+{
+	int i, n_candidates;
+	selector_choice_t candidates[1 + SELECTOR_N_VEC_STRATS];
+	selector_data_t *data = calloc(1, sizeof(selector_data_t));
+	data->model = model;
+	n_candidates = selector_candidates(opt, candidates);
+	data->with_parasail = (candidates[n_candidates - 1].library == Parasail);
+	for (i = 0; i < n; ++i) {
+		if (choices[i].library == Ksw2) {
+			if (data->ksw2_data == NULL) data->ksw2_data = ksw2_data_init(opt, opt->_matrix);
+		}
+		else if (data->parasail_data[choices[i].vec_strategy] == NULL) {
+			data->parasail_data[choices[i].vec_strategy] = parasail_data_init(opt, opt->_matrix, choices[i].vec_strategy, err);
+			if (data->parasail_data[choices[i].vec_strategy] == NULL) {
+				selector_data_destroy(data);
+				return NULL;
+			}
+		}
+	}
+	return data;
+}
+
+selector_data_t *selector_data_init(main_opt_t *opt, char *err)
+{
+	return selector_data_init_choices(opt, opt->_selector_model, opt->_selector_model->choices, opt->_selector_model->n, err);
+}
+
+void selector_data_destroy(selector_data_t *data)
+{
+	int i;
+	if (data->ksw2_data != NULL) ksw2_data_destroy(data->ksw2_data);
+	for (i = 0; i < SELECTOR_N_VEC_STRATS; ++i) {
+		if (data->parasail_data[i] != NULL) parasail_data_destroy(data->parasail_data[i]);
+	}
+	free(data);
+}
+
+// Aligns the pair with the given choice.  For global alignment, the start from ksw2 follows parasail's conventions
+// when parasail supports the options, so that the output does not depend on the model: it is only known with the
+// cigar or -S, and only for pairs that reach the minimum score (-T).
+static void selector_align(selector_data_t *data, const selector_choice_t *choice, const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, alignment_t *alignment)
+{
+	if (choice->library == Ksw2) {
+		align_with_ksw2(query, query_length, target, target_length, opt, data->ksw2_data, alignment);
+		if (data->with_parasail && opt->alignment_mode == Global) {
+			if ((opt->add_cigar != 1 && opt->find_starts != 1) || alignment->score < opt->min_score) {
+				alignment->qlb = alignment->tlb = -1;
+			}
+		}
+	}
+	else {
+		align_with_parasail(query, query_length, target, target_length, opt, data->parasail_data[choice->vec_strategy], alignment);
+	}
+}
+
+void align_with_selector(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, void *library_data, alignment_t *alignment)
+{
+	selector_data_t *data = (selector_data_t*)library_data;
+	const selector_model_t *model = data->model;
+	int i, length = (query_length < target_length) ? target_length : query_length;
+	for (i = 0; i < model->n - 1 && model->choices[i].max_length < length; ++i);
+	selector_align(data, &model->choices[i], query, query_length, target, target_length, opt, alignment);
+}
+
+/***************/
+/* calibration */
+/***************/
+
+// splitmix64, so that the simulated pairs are the same on every platform
+static inline uint64_t selector_rand(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// Simulates a random query, and a target that differs by about 5% substitutions and 1% single-base indels
+static void selector_simulate(uint64_t *x, int length, char *query, char *target)
+{
+	static const char bases[4] = { 'A', 'C', 'G', 'T' };
+	int i, k;
+	for (i = 0; i < length; ++i) query[i] = bases[selector_rand(x) & 3];
+	query[length] = '\0';
+	for (i = k = 0; i < length; ++i) {
+		int r = selector_rand(x) % 200;
+		if (r == 0) continue; // deletion
+		if (r == 1) target[k++] = bases[selector_rand(x) & 3]; // insertion, then the base
+		target[k++] = (r < 10) ? bases[selector_rand(x) & 3] : query[i]; // substitution (maybe with the same base)
+	}
+	target[k] = '\0';
+}
+
+static inline double selector_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Adds the choice for pairs up to the given length, extending the last choice if it is the same.  Returns non-zero,
+// with the message in err, if the model is full.
+static int selector_model_add(selector_model_t *model, int max_length, int library, int vec_strategy, char *err)
+{
+	selector_choice_t *last = (model->n > 0) ? &model->choices[model->n - 1] : NULL;
+	if (last != NULL && last->library == library && last->vec_strategy == vec_strategy) {
+		last->max_length = max_length;
+		return 0;
+	}
+	check_or_return(err, model->n < SELECTOR_MAX_CHOICES, "Too many choices in the cost model (at most %d).", SELECTOR_MAX_CHOICES);
+	model->choices[model->n].max_length = max_length;
+	model->choices[model->n].library = library;
+	model->choices[model->n].vec_strategy = vec_strategy;
+	model->n++;
+	return 0;
+}
+
+selector_model_t *selector_model_calibrate(main_opt_t *opt, char *err)
+{
+	selector_model_t *model = calloc(1, sizeof(selector_model_t));
+	selector_choice_t candidates[1 + SELECTOR_N_VEC_STRATS];
+	int i, j, length, n_candidates = selector_candidates(opt, candidates), ret = 0;
+	char *queries[SELECTOR_N_PAIRS], *targets[SELECTOR_N_PAIRS];
+	uint64_t x = 11;
+
+	// nothing to choose from
+	if (n_candidates == 1) {
+		selector_model_add(model, SELECTOR_MAX_LENGTH, candidates[0].library, candidates[0].vec_strategy, err);
+		return model;
+	}
+
+	selector_data_t *data = selector_data_init_choices(opt, model, candidates, n_candidates, err);
+	if (data == NULL) {
+		free(model);
+		return NULL;
+	}
+	alignment_t *alignment = alignment_init();
+	for (i = 0; i < SELECTOR_N_PAIRS; ++i) {
+		queries[i] = malloc(SELECTOR_MAX_LENGTH + 1);
+		targets[i] = malloc(2 * SELECTOR_MAX_LENGTH + 1); // at most one insertion per base
+	}
+
+	for (length = SELECTOR_MIN_LENGTH; ret == 0 && length <= SELECTOR_MAX_LENGTH; length <<= 1) {
+		// pairs in the middle of the lengths for this choice
+		int pair_length = length - length / 4;
+		int64_t n_cells = (int64_t)pair_length * pair_length;
+		int n_pairs = (n_cells < SELECTOR_MIN_CELLS) ? (int)(SELECTOR_MIN_CELLS / n_cells) : 1;
+		int best = 0;
+		double best_seconds = 0.0;
+		for (i = 0; i < SELECTOR_N_PAIRS; ++i) selector_simulate(&x, pair_length, queries[i], targets[i]);
+		for (j = 0; j < n_candidates; ++j) {
+			// align a pair first, so the time does not include growing the buffers
+			alignment_reset(alignment);
+			selector_align(data, &candidates[j], queries[0], pair_length, targets[0], strlen(targets[0]), opt, alignment);
+			double start = selector_now();
+			for (i = 0; i < n_pairs; ++i) {
+				int k = i % SELECTOR_N_PAIRS;
+				alignment_reset(alignment);
+				selector_align(data, &candidates[j], queries[k], pair_length, targets[k], strlen(targets[k]), opt, alignment);
+			}
+			double seconds = selector_now() - start;
+			if (j == 0 || seconds < best_seconds) {
+				best = j;
+				best_seconds = seconds;
+			}
+		}
+		ret = selector_model_add(model, length, candidates[best].library, candidates[best].vec_strategy, err);
+	}
+
+	for (i = 0; i < SELECTOR_N_PAIRS; ++i) {
+		free(queries[i]);
+		free(targets[i]);
+	}
+	alignment_destroy(alignment);
+	selector_data_destroy(data);
+	if (ret != 0) {
+		free(model);
+		return NULL;
+	}
+	return model;
+}
+
+/***************/
+/* model files */
+/***************/
+
+// Parses a line of a model file into the choice.  Returns non-zero on error.
+static int selector_choice_parse(const main_opt_t *opt, const char *line, selector_choice_t *choice, char *err)
+{
+	char library[64], vec_strategy[64];
+	int i;
+	check_or_return(err, sscanf(line, "%d\t%63s\t%63s", &choice->max_length, library, vec_strategy) == 3, "Expected the length, library, and vectorization strategy");
+	if (strcmp(library, library_to_str(Ksw2)) == 0) {
+		choice->library = Ksw2;
+		choice->vec_strategy = 0;
+	}
+	else if (strcmp(library, library_to_str(Parasail)) == 0) {
+		choice->library = Parasail;
+		for (i = 0; i < SELECTOR_N_VEC_STRATS && strcmp(vec_strategy, selector_vec_strat_names[i]) != 0; ++i);
+		check_or_return(err, i < SELECTOR_N_VEC_STRATS, "Unknown vectorization strategy '%s'", vec_strategy);
+		choice->vec_strategy = i;
+	}
+	else return set_error(err, "Unknown library '%s'", library);
+	check_or_return(err, selector_is_candidate(opt, choice), "The library '%s' does not support the options", library);
+	return 0;
+}
+
+selector_model_t *selector_model_read(main_opt_t *opt, const char *fn, char *err)
+{
+	selector_model_t *model;
+	char line[1024], line_err[KSW_ERR_LEN];
+	int line_number = 0;
+	FILE *fp = fopen(fn, "r");
+	if (fp == NULL) {
+		set_error(err, "Could not open the cost model (-P) '%s'.", fn);
+		return NULL;
+	}
+	model = calloc(1, sizeof(selector_model_t));
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		selector_choice_t choice;
+		line_number++;
+		if (line[0] == '#' || line[0] == '\n') continue;
+		if (selector_choice_parse(opt, line, &choice, line_err) == 0) {
+			if (model->n > 0 && choice.max_length <= model->choices[model->n - 1].max_length) set_error(line_err, "Lengths must increase, found %d", choice.max_length);
+			else if (model->n == SELECTOR_MAX_CHOICES) set_error(line_err, "Too many choices (at most %d)", SELECTOR_MAX_CHOICES);
+			else {
+				model->choices[model->n++] = choice;
+				continue;
+			}
+		}
+		set_error(err, "%s on line %d of the cost model '%s'.", line_err, line_number, fn);
+		fclose(fp);
+		free(model);
+		return NULL;
+	}
+	fclose(fp);
+	if (model->n == 0) {
+		set_error(err, "No choices found in the cost model '%s'.", fn);
+		free(model);
+		return NULL;
+	}
+	return model;
+}
+
+void selector_model_write(FILE *fp, const selector_model_t *model)
+{
+	int i;
+	fprintf(fp, "#max_length\tlibrary\tvec_strategy\n");
+	for (i = 0; i < model->n; ++i) {
+		const selector_choice_t *choice = &model->choices[i];
+		fprintf(fp, "%d\t%s\t%s\n", choice->max_length, library_to_str(choice->library),
+				choice->library == Parasail ? selector_vec_strat_names[choice->vec_strategy] : "-");
+	}
+}
+
+void selector_model_destroy(selector_model_t *model)
+{
+	free(model);
+}
@@ -0,0 +1,43 @@
+#ifndef __SELECTOR_H
+#define __SELECTOR_H
+
+/* Chooses the library, and parasail's vectorization strategy, for each pair (-l 3) from the length of the pair and the
+ * alignment mode.  The choice for each length comes from a small cost model that is either calibrated at startup, by
+ * timing each library on simulated pairs, or read from a file (-P).  The score width is already chosen for each pair
+ * (see -W), so is not part of the model.
+ *
+ * The model file has one choice per line, with the longest pair (the longer of the query and target) for that choice,
+ * the library (ksw2 or parasail), and parasail's vectorization strategy (striped, scan, or diag; otherwise "-"), all
+ * separated by tabs and in increasing order of length.  Pairs longer than the last line use the last line.  Lines
+ * starting with '#' are ignored.
+ *
+ * The choice never changes the output.  As ksw2 and parasail may place gaps differently, a global alignment with the
+ * cigar (-c) only chooses between parasail's strategies when parasail supports the options, and ksw2 is then not a
+ * valid choice in the model.
+ */
+
+typedef struct selector_model_t selector_model_t;
+typedef struct selector_data_t selector_data_t;
+
+// Times each library that supports the options on simulated pairs, for lengths doubling from 32 to 2048.  Returns NULL,
+// with the message in err, on error.
+selector_model_t *selector_model_calibrate(main_opt_t *opt, char *err);
+
+// Reads the model from a file.  Returns NULL, with the message in err, if the file is malformed or a choice does not
+// support the options.
+selector_model_t *selector_model_read(main_opt_t *opt, const char *fn, char *err);
+
+// Writes the model in the same format as it is read
+void selector_model_write(FILE *fp, const selector_model_t *model);
+
+void selector_model_destroy(selector_model_t *model);
+
+// Creates the library data for every choice in opt->_selector_model, so that each pair may use any of them.  Returns
+// NULL, with the message in err, on error.
+selector_data_t *selector_data_init(main_opt_t *opt, char *err);
+
+void selector_data_destroy(selector_data_t *data);
+
+void align_with_selector(const char *query, int query_length, const char *target, int target_length, main_opt_t *opt, void *library_data, alignment_t *alignment);
+
+#endif
@@ -0,0 +1,340 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ksw2/kseq.h"
+#include "ksw2/ksw2.h"
+#include "parasail/parasail.h"
+#include "kthread.h"
+#include "main.h"
+#include "binary.h"
+#include "server.h"
+
+#define SERVER_READ_SIZE        (1<<16)
+#define SERVER_MAX_INPUT        (4<<20) // stop reading a client with this many bytes of frames waiting to be aligned
+#define SERVER_MAX_OUTPUT       (4<<20) // stop reading a client with this many bytes of records waiting to be sent
+#define SERVER_LISTEN_BACKLOG   64
+
+/*******************/
+/* server_client_t */
+/*******************/
+
+typedef struct {
+	int fd;
+	uint8_t *buf; // frames received but not yet aligned are in [begin, end)
+	size_t begin, end, m;
+	kstring_t out; // records not yet sent are in [out_begin, out.l)
+	size_t out_begin;
+	binary_params_t defaults;
+	int is_eof; // the client will send no more frames, so close once its records are sent
+	int is_bad; // close now, as the connection failed or the client sent a malformed frame
+} server_client_t;
+
+static server_client_t *server_client_init(int fd)
+{
+	server_client_t *c = (server_client_t*)calloc(1, sizeof(server_client_t));
+	c->fd = fd;
+	return c;
+}
+
+static void server_client_destroy(server_client_t *c)
+{
+	close(c->fd);
+	free(c->buf);
+	free(c->out.s);
+	free(c);
+}
+
+static inline int server_client_has_frame(const server_client_t *c)
+{
+	uint32_t length;
+	if (c->is_bad || c->end - c->begin < 4) return 0;
+	memcpy(&length, c->buf + c->begin, 4);
+	return c->end - c->begin >= 4 + (size_t)length;
+}
+
+// Whether the client may send more before some of its frames are aligned or its records are sent
+static inline int server_client_can_read(const server_client_t *c)
+{
+	if (c->is_eof || c->is_bad || c->out.l - c->out_begin >= SERVER_MAX_OUTPUT) return 0;
+	// always read a frame larger than the limit in full, as a frame longer than BINARY_MAX_FRAME_LENGTH is rejected once
+	// its length is read
+	return c->end - c->begin < SERVER_MAX_INPUT || !server_client_has_frame(c);
+}
+
+static void server_client_read(server_client_t *c)
+{
+	ssize_t n_read;
+	if (c->begin > 0) {
+		memmove(c->buf, c->buf + c->begin, c->end - c->begin);
+		c->end -= c->begin;
+		c->begin = 0;
+	}
+	if (c->m < c->end + SERVER_READ_SIZE) {
+		c->m = c->end + SERVER_READ_SIZE;
+		c->buf = (uint8_t*)realloc(c->buf, c->m);
+	}
+	n_read = read(c->fd, c->buf + c->end, c->m - c->end);
+	if (n_read < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return;
+		c->is_bad = 1;
+	}
+	else if (n_read == 0) c->is_eof = 1;
+	else c->end += n_read;
+}
+
+static void server_client_write(server_client_t *c)
+{
+	while (c->out_begin < c->out.l) {
+		ssize_t n_written = write(c->fd, c->out.s + c->out_begin, c->out.l - c->out_begin);
+		if (n_written < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) c->is_bad = 1;
+			break;
+		}
+		c->out_begin += n_written;
+	}
+	if (c->out_begin == c->out.l) c->out_begin = c->out.l = 0;
+}
+
+static inline int server_client_is_done(const server_client_t *c)
+{
+	return c->is_bad || (c->is_eof && !server_client_has_frame(c) && c->out_begin == c->out.l);
+}
+
+/************/
+/* serve()  */
+/************/
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_on_signal(int sig)
+{
+	(void)sig;
+	server_stop = 1;
+}
+
+static int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Creates the listening socket, replacing a socket at path only if no server is listening on it
+static int server_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: socket path is too long (at most %d characters): %s\n", (int)sizeof(addr.sun_path) - 1, path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "Error: %s exists and is not a socket\n", path);
+			return -1;
+		}
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+			fprintf(stderr, "Error: a server is already listening on %s\n", path);
+			close(fd);
+			return -1;
+		}
+		if (fd >= 0) close(fd);
+		unlink(path); // left by a server that did not exit cleanly
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SERVER_LISTEN_BACKLOG) < 0 || set_nonblocking(fd) < 0) {
+		fprintf(stderr, "Error: could not listen on %s: %s\n", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+typedef struct {
+	main_opt_t *opt;
+	void **library_data;
+	binary_frame_t *frames;
+} server_batch_t;
+
+static void server_align_worker(void *data, long i, int tid)
+{
+	server_batch_t *b = (server_batch_t*)data;
+	binary_frame_align(b->opt, b->library_data[tid], &b->frames[i]);
+}
+
+int serve(const char *path, main_opt_t *opt, void **library_data)
+{
+	int i, j, n, n_clients = 0, m_fds = 0, first = 0, listen_fd, ret = 0;
+	server_client_t **clients = NULL;
+	struct pollfd *fds = NULL;
+	int *owners;
+	void *pool;
+	server_batch_t b;
+	struct sigaction sa, old_int, old_term, old_pipe;
+	char err[KSW_ERR_LEN];
+
+	if ((listen_fd = server_listen(path)) < 0) return 1;
+	server_stop = 0;
+
+	// stop on SIGINT and SIGTERM (interrupting poll()), and report a closed connection as a failed write
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = server_on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, &old_pipe);
+	if (opt->verbose) fprintf(stderr, "[server] listening on %s\n", path);
+
+	b.opt = opt;
+	b.library_data = library_data;
+	b.frames = (binary_frame_t*)calloc(opt->batch_size, sizeof(binary_frame_t));
+	owners = (int*)malloc(opt->batch_size * sizeof(int));
+	pool = kt_forpool_init(opt->n_threads);
+
+	while (!server_stop) {
+		int timeout = -1;
+
+		// wait for a connection, frames from a client that may send more, or room to send records
+		if (m_fds < n_clients + 1) {
+			m_fds = n_clients + 1;
+			kroundup32(m_fds);
+			fds = (struct pollfd*)realloc(fds, m_fds * sizeof(struct pollfd));
+		}
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (i = 0; i < n_clients; ++i) {
+			server_client_t *c = clients[i];
+			fds[i + 1].fd = c->fd;
+			fds[i + 1].events = (server_client_can_read(c) ? POLLIN : 0) | (c->out_begin < c->out.l ? POLLOUT : 0);
+			if (server_client_has_frame(c) && c->out.l - c->out_begin < SERVER_MAX_OUTPUT) timeout = 0;
+		}
+		if (poll(fds, n_clients + 1, timeout) < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "Error: could not poll the connections: %s\n", strerror(errno));
+			ret = 1;
+			break;
+		}
+
+		for (i = 0; i < n_clients; ++i) {
+			short revents = fds[i + 1].revents;
+			if (revents & POLLOUT) server_client_write(clients[i]);
+			if ((fds[i + 1].events & POLLIN) && (revents & (POLLIN | POLLHUP))) server_client_read(clients[i]);
+			else if (revents & (POLLERR | POLLNVAL)) clients[i]->is_bad = 1;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd;
+			while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+				if (set_nonblocking(fd) < 0) {
+					close(fd);
+					continue;
+				}
+				clients = (server_client_t**)realloc(clients, (n_clients + 1) * sizeof(server_client_t*));
+				clients[n_clients++] = server_client_init(fd);
+			}
+		}
+
+		// take one frame from each client in turn, starting from a different client each batch, skipping clients
+		// with too many records waiting to be sent
+		n = 0;
+		for (;;) {
+			int n_taken = 0;
+			for (j = 0; j < n_clients && n < opt->batch_size; ++j) {
+				int k = (first + j) % n_clients;
+				server_client_t *c = clients[k];
+				long n_parsed;
+				// parse once the length is read, so a frame that is too long is rejected before it is buffered
+				if (c->is_bad || c->end - c->begin < 4 || c->out.l - c->out_begin >= SERVER_MAX_OUTPUT) continue;
+				n_parsed = binary_frame_parse(c->buf + c->begin, c->end - c->begin, &c->defaults, &b.frames[n], err);
+				if (n_parsed == 0) continue;
+				if (n_parsed < 0) {
+					fprintf(stderr, "Error: closing a connection: %s\n", err);
+					c->is_bad = 1;
+					continue;
+				}
+				c->begin += n_parsed;
+				owners[n++] = k;
+				n_taken++;
+			}
+			if (n_taken == 0 || n == opt->batch_size) break;
+		}
+		if (n_clients > 0) first = (first + 1) % n_clients;
+
+		if (n > 0) {
+			kt_forpool(pool, server_align_worker, &b, n);
+			// in batch order, so each client's records are in the order of its frames
+			for (i = 0; i < n; ++i) binary_record_append(&clients[owners[i]]->out, opt, &b.frames[i]);
+			for (i = 0; i < n_clients; ++i) {
+				if (clients[i]->out_begin < clients[i]->out.l) server_client_write(clients[i]);
+			}
+		}
+
+		// close the clients that are done
+		for (i = j = 0; i < n_clients; ++i) {
+			server_client_t *c = clients[i];
+			if (server_client_is_done(c)) {
+				if (!c->is_bad && c->begin < c->end) fprintf(stderr, "Error: closing a connection: truncated frame at the end of the input\n");
+				server_client_destroy(c);
+			}
+			else clients[j++] = c;
+		}
+		n_clients = j;
+	}
+
+	for (i = 0; i < n_clients; ++i) server_client_destroy(clients[i]);
+	for (i = 0; i < opt->batch_size; ++i) binary_frame_destroy(&b.frames[i]);
+	kt_forpool_destroy(pool);
+	free(b.frames);
+	free(owners);
+	free(clients);
+	free(fds);
+	close(listen_fd);
+	unlink(path);
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+	sigaction(SIGPIPE, &old_pipe, NULL);
+	return ret;
+}
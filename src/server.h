@@ -0,0 +1,24 @@
+#ifndef __SERVER_H
+#define __SERVER_H
+
+/* Serves many clients at once over a Unix domain socket (--listen), with the binary framed protocol (see binary.h)
+ * on each connection.
+ *
+ * A single thread polls the socket and every connection, and gathers the frames that have fully arrived into a batch,
+ * taking one frame from each client in turn so that no client starves the others.  The batch (at most -K frames) is
+ * aligned on a pool of -t threads that is created once, then each record is queued on its connection in the order its
+ * frames arrived.  Params set with BinaryFrameSetParams apply only to that connection, but only the gap open and
+ * extend penalties, band width, and z-drop can be set: the mode, match and mismatch scores, and matrix are those given
+ * on the command line for every connection.
+ *
+ * A client that stops reading its records is not read from once too much of its output is queued, and a client that
+ * sends more than is buffered is not read from until its frames are aligned, so the socket buffers push back on it.
+ * A connection with a malformed frame is closed.  The server runs until it receives SIGINT or SIGTERM, then removes
+ * the socket.
+ */
+
+// Listens on path, using the library data per thread (opt->n_threads).  Returns non-zero on error, with the message
+// written to standard error.
+int serve(const char *path, main_opt_t *opt, void **library_data);
+
+#endif
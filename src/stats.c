@@ -0,0 +1,264 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+#define STATS_N_BINS 33 // lengths of zero, then from 2^(i-1) to 2^i - 1 in the i-th bin
+
+const char *stats_format_to_str(int format)
+{
+	switch (format) {
+		case StatsOff: return "off";
+		case StatsTsv: return "tsv";
+		case StatsJson: return "json";
+		default: return "unknown";
+	}
+}
+
+int stats_format_from_str(const char *str)
+{
+	int i;
+	for (i = StatsOff; i <= StatsJson; ++i) {
+		if (strcmp(str, stats_format_to_str(i)) == 0) return i;
+	}
+	return -1;
+}
+
+#ifdef KSW_STATS
+
+static const char *stats_stage_names[] = { "parse", "encode", "kernel", "cigar", "output" };
+static const char *stats_kernel_names[] = { "ksw2_extz2", "ksw2_extd2", "parasail_8", "parasail_16", "parasail_32", "parasail_banded", "interseq", "ungapped" };
+
+typedef struct stats_t {
+	uint64_t stage_ns[StatsStageEnd + 1];
+	uint64_t kernel_calls[StatsKernelEnd + 1];
+	uint64_t kernel_cells[StatsKernelEnd + 1];
+	uint64_t n_alignments, n_allocs, n_profiles, n_skips;
+	uint64_t query_lengths[STATS_N_BINS], target_lengths[STATS_N_BINS];
+	struct stats_t *next;
+} stats_t;
+
+int stats_enabled = 0;
+
+static int stats_format = StatsOff;
+static uint64_t stats_wall_start;
+static stats_t *stats_threads = NULL; // the blocks of running threads
+static stats_t stats_exited; // the sum of the blocks of threads that have exited
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static __thread stats_t *stats_local = NULL;
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stats_sum(stats_t *sum, const stats_t *s)
+{
+	int i;
+	for (i = 0; i <= StatsStageEnd; ++i) sum->stage_ns[i] += s->stage_ns[i];
+	for (i = 0; i <= StatsKernelEnd; ++i) {
+		sum->kernel_calls[i] += s->kernel_calls[i];
+		sum->kernel_cells[i] += s->kernel_cells[i];
+	}
+	sum->n_alignments += s->n_alignments;
+	sum->n_allocs += s->n_allocs;
+	sum->n_profiles += s->n_profiles;
+	sum->n_skips += s->n_skips;
+	for (i = 0; i < STATS_N_BINS; ++i) {
+		sum->query_lengths[i] += s->query_lengths[i];
+		sum->target_lengths[i] += s->target_lengths[i];
+	}
+}
+
+// Folds the block of an exiting thread into the sum, as kt_for() creates new threads for each batch
+static void stats_thread_exit(void *data)
+{
+	stats_t *s = (stats_t*)data, **p;
+	pthread_mutex_lock(&stats_mutex);
+	for (p = &stats_threads; *p != s; p = &(*p)->next);
+	*p = s->next;
+	stats_sum(&stats_exited, s);
+	pthread_mutex_unlock(&stats_mutex);
+	free(s);
+}
+
+static inline stats_t *stats_get(void)
+{
+	if (stats_local == NULL) {
+		stats_local = calloc(1, sizeof(stats_t));
+		pthread_setspecific(stats_key, stats_local);
+		pthread_mutex_lock(&stats_mutex);
+		stats_local->next = stats_threads;
+		stats_threads = stats_local;
+		pthread_mutex_unlock(&stats_mutex);
+	}
+	return stats_local;
+}
+
+void stats_add_time(int stage, uint64_t start)
+{
+	stats_get()->stage_ns[stage] += stats_now() - start;
+}
+
+void stats_add_kernel(int kernel, uint64_t cells, uint64_t start)
+{
+	stats_t *s = stats_get();
+	s->stage_ns[StatsKernel] += stats_now() - start;
+	s->kernel_calls[kernel]++;
+	s->kernel_cells[kernel] += cells;
+}
+
+static inline int stats_bin(int length)
+{
+	int i = 0;
+	while (length > 0) length >>= 1, i++;
+	return i;
+}
+
+void stats_add_alignment(int query_length, int target_length)
+{
+	stats_t *s = stats_get();
+	s->n_alignments++;
+	s->query_lengths[stats_bin(query_length)]++;
+	s->target_lengths[stats_bin(target_length)]++;
+}
+
+void stats_add_alloc(void)
+{
+	stats_get()->n_allocs++;
+}
+
+void stats_add_profile(void)
+{
+	stats_get()->n_profiles++;
+}
+
+void stats_add_skip(void)
+{
+	stats_get()->n_skips++;
+}
+
+/**********/
+/* report */
+/**********/
+
+static void stats_print_bins(FILE *fp, const char *name, const uint64_t *bins)
+{
+	int i, first = 1;
+	if (stats_format == StatsJson) fprintf(fp, ",\n  \"%s\": {", name);
+	for (i = 0; i < STATS_N_BINS; ++i) {
+		uint64_t lo = i == 0 ? 0 : 1ULL << (i - 1), hi = i == 0 ? 0 : (1ULL << i) - 1;
+		if (bins[i] == 0) continue;
+		if (stats_format == StatsJson) fprintf(fp, "%s\"%llu-%llu\": %llu", first ? "" : ", ", (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)bins[i]);
+		else fprintf(fp, "%s.%llu-%llu\t%llu\n", name, (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)bins[i]);
+		first = 0;
+	}
+	if (stats_format == StatsJson) fprintf(fp, "}");
+}
+
+// Writes a value, as "prefix.name<tab>value" or a JSON member, with six decimal places if not an integer
+static void stats_print(FILE *fp, int *first, const char *prefix, const char *name, double value, int is_int)
+{
+	if (stats_format == StatsJson) fprintf(fp, "%s\"%s\": %.*f", *first ? "" : ", ", name, is_int ? 0 : 6, value);
+	else fprintf(fp, "%s%s%s\t%.*f\n", prefix, prefix[0] ? "." : "", name, is_int ? 0 : 6, value);
+	*first = 0;
+}
+
+void stats_report(FILE *fp)
+{
+	stats_t sum;
+	const stats_t *s;
+	uint64_t cells = 0;
+	double wall, kernel;
+	int i, first;
+
+	if (!stats_enabled) return;
+	memset(&sum, 0, sizeof(stats_t));
+	pthread_mutex_lock(&stats_mutex);
+	stats_sum(&sum, &stats_exited);
+	for (s = stats_threads; s != NULL; s = s->next) stats_sum(&sum, s);
+	pthread_mutex_unlock(&stats_mutex);
+	for (i = 0; i <= StatsKernelEnd; ++i) cells += sum.kernel_cells[i];
+	wall = (stats_now() - stats_wall_start) * 1e-9;
+	kernel = sum.stage_ns[StatsKernel] * 1e-9;
+
+	first = 1;
+	if (stats_format == StatsJson) fprintf(fp, "{\n  \"summary\": {");
+	stats_print(fp, &first, "", "wall_seconds", wall, 0);
+	stats_print(fp, &first, "", "alignments", sum.n_alignments, 1);
+	stats_print(fp, &first, "", "cells", cells, 1);
+	stats_print(fp, &first, "", "dp_skipped", sum.n_skips, 1); // proven ungapped, see align_ungapped()
+	stats_print(fp, &first, "", "gcups", wall > 0 ? cells / wall * 1e-9 : 0, 0); // over the wall time, on all threads
+	stats_print(fp, &first, "", "kernel_gcups", kernel > 0 ? cells / kernel * 1e-9 : 0, 0); // per thread, in the kernels
+	stats_print(fp, &first, "", "allocs", sum.n_allocs, 1);
+	stats_print(fp, &first, "", "parasail_profiles", sum.n_profiles, 1);
+	if (stats_format == StatsJson) fprintf(fp, "},\n  \"stage_seconds\": {");
+	for (i = 0, first = 1; i <= StatsStageEnd; ++i) stats_print(fp, &first, "stage_seconds", stats_stage_names[i], sum.stage_ns[i] * 1e-9, 0);
+	if (stats_format == StatsJson) fprintf(fp, "},\n  \"kernel_calls\": {");
+	for (i = 0, first = 1; i <= StatsKernelEnd; ++i) stats_print(fp, &first, "kernel_calls", stats_kernel_names[i], sum.kernel_calls[i], 1);
+	if (stats_format == StatsJson) fprintf(fp, "},\n  \"kernel_cells\": {");
+	for (i = 0, first = 1; i <= StatsKernelEnd; ++i) stats_print(fp, &first, "kernel_cells", stats_kernel_names[i], sum.kernel_cells[i], 1);
+	if (stats_format == StatsJson) fprintf(fp, "}");
+	stats_print_bins(fp, "query_length", sum.query_lengths);
+	stats_print_bins(fp, "target_length", sum.target_lengths);
+	if (stats_format == StatsJson) fprintf(fp, "\n}\n");
+	fflush(fp);
+}
+
+static void *stats_signal_worker(void *data)
+{
+	sigset_t *set = (sigset_t*)data;
+	int sig;
+	for (;;) {
+		if (sigwait(set, &sig) == 0) stats_report(stderr);
+	}
+	return 0;
+}
+
+void stats_init(int format)
+{
+	static sigset_t set;
+	pthread_t tid;
+	stats_format = format;
+	stats_wall_start = stats_now();
+	pthread_key_create(&stats_key, stats_thread_exit);
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	pthread_create(&tid, 0, stats_signal_worker, &set);
+	pthread_detach(tid);
+	stats_enabled = 1;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+/* Instrumentation of the hot path (--stats): the time spent in each stage, the DP cells computed by each kernel, the
+ * lengths of the aligned sequences, and the buffers allocated.  Each thread counts into its own block, and the blocks
+ * are summed into a report written to standard error on exit, or whenever the process receives SIGUSR1, as TSV or JSON.
+ *
+ * The counters are only updated after stats_init(), and the STATS_* macros compile to nothing unless built with
+ * KSW_STATS (see `make stats=0`).  A report while aligning may be slightly behind, as the counters of other threads
+ * are read without synchronization.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum StatsFormat {
+	StatsOff  = 0,
+	StatsTsv  = 1,
+	StatsJson = 2,
+};
+
+enum StatsStage {
+	StatsStageStart = 0,
+	StatsParse      = 0, // reading pairs or frames
+	StatsEncode     = 1, // converting bases to integers (seq_nt4_table) and reverse-complementing
+	StatsKernel     = 2, // dynamic programming
+	StatsCigar      = 3, // converting parasail's traceback to the cigar
+	StatsOutput     = 4, // formatting the output
+	StatsStageEnd   = 4,
+};
+
+enum StatsKernel {
+	StatsKernelStart    = 0,
+	StatsKsw2Extz2      = 0,
+	StatsKsw2Extd2      = 1,
+	StatsParasail8      = 2,
+	StatsParasail16     = 3,
+	StatsParasail32     = 4,
+	StatsParasailBanded = 5,
+	StatsInterseq       = 6,
+	StatsUngapped       = 7, // the ungapped pass before the DP, see align_ungapped()
+	StatsKernelEnd      = 7,
+};
+
+const char *stats_format_to_str(int format);
+int stats_format_from_str(const char *str);
+
+// The cells computed for a pair by a kernel with the given band width, or all of them if negative
+static inline uint64_t stats_band_cells(int query_length, int target_length, int band_width)
+{
+	uint64_t width = (band_width < 0 || 2 * (uint64_t)band_width + 1 > (uint64_t)target_length) ? (uint64_t)target_length : 2 * (uint64_t)band_width + 1;
+	return (uint64_t)query_length * width;
+}
+
+#ifdef KSW_STATS
+
+extern int stats_enabled;
+
+// Starts counting, and reporting in the given format on SIGUSR1.  Call before creating any other thread, as SIGUSR1 is
+// blocked in the calling thread (and so in the threads it creates) and handled by a thread of its own.
+void stats_init(int format);
+
+// Writes the report, if counting
+void stats_report(FILE *fp);
+
+uint64_t stats_now(void);
+void stats_add_time(int stage, uint64_t start);
+void stats_add_kernel(int kernel, uint64_t cells, uint64_t start);
+void stats_add_alignment(int query_length, int target_length);
+void stats_add_alloc(void);
+void stats_add_profile(void);
+void stats_add_skip(void);
+
+#define STATS_START(t)                  uint64_t t = stats_enabled ? stats_now() : 0
+#define STATS_STAGE(stage, t)           do { if (stats_enabled) stats_add_time(stage, t); } while (0)
+#define STATS_KERNEL(kernel, cells, t)  do { if (stats_enabled) stats_add_kernel(kernel, cells, t); } while (0)
+#define STATS_ALIGNMENT(ql, tl)         do { if (stats_enabled) stats_add_alignment(ql, tl); } while (0)
+#define STATS_ALLOC()                   do { if (stats_enabled) stats_add_alloc(); } while (0)
+#define STATS_PROFILE()                 do { if (stats_enabled) stats_add_profile(); } while (0)
+#define STATS_SKIP()                    do { if (stats_enabled) stats_add_skip(); } while (0)
+#define STATS_REPORT(fp)                stats_report(fp)
+
+#else
+
+#define STATS_START(t)
+#define STATS_STAGE(stage, t)           do { } while (0)
+#define STATS_KERNEL(kernel, cells, t)  do { (void)(cells); } while (0)
+#define STATS_ALIGNMENT(ql, tl)         do { } while (0)
+#define STATS_ALLOC()                   do { } while (0)
+#define STATS_PROFILE()                 do { } while (0)
+#define STATS_SKIP()                    do { } while (0)
+#define STATS_REPORT(fp)                do { } while (0)
+
+#endif
+
+#endif
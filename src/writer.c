@@ -0,0 +1,125 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "writer.h"
+
+// unless always flushing, the buffer is written once it has at least this many bytes
+#define WRITER_BLOCK_SIZE (1<<16)
+
+writer_t *writer_init(int fd, int flush_policy)
+{
+	writer_t *w = calloc(1, sizeof(writer_t));
+	w->fd = fd;
+	w->flush_policy = flush_policy;
+	w->m = WRITER_BLOCK_SIZE;
+	w->buf = malloc(w->m);
+	return w;
+}
+
+void writer_reserve(writer_t *w, size_t n)
+{
+	if (w->m < w->n + n) {
+		while (w->m < w->n + n) w->m <<= 1;
+		w->buf = realloc(w->buf, w->m);
+	}
+}
+
+void writer_flush(writer_t *w)
+{
+	size_t off = 0;
+	while (off < w->n) {
+		ssize_t n_written = write(w->fd, w->buf + off, w->n - off);
+		if (n_written < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "Error: could not write output: %s\n", strerror(errno));
+			exit(1);
+		}
+		off += n_written;
+	}
+	w->n = 0;
+}
+
+void writer_puts(writer_t *w, const char *s)
+{
+	writer_write(w, s, strlen(s));
+}
+
+void writer_write(writer_t *w, const char *s, size_t n)
+{
+	writer_reserve(w, n);
+	memcpy(w->buf + w->n, s, n);
+	w->n += n;
+}
+
+void writer_put_int(writer_t *w, int32_t x)
+{
+	char tmp[12];
+	int i = 0;
+	uint32_t u = (x < 0) ? -(uint32_t)x : (uint32_t)x;
+	writer_reserve(w, 12);
+	if (x < 0) w->buf[w->n++] = '-';
+	do { tmp[i++] = '0' + u % 10; u /= 10; } while (u > 0);
+	while (i > 0) w->buf[w->n++] = tmp[--i];
+}
+
+void writer_maybe_flush(writer_t *w, int is_idle)
+{
+	switch (w->flush_policy) {
+		case FlushAlways: writer_flush(w); break;
+		case FlushOnIdle: if (is_idle || w->n >= WRITER_BLOCK_SIZE) writer_flush(w); break;
+		default: if (w->n >= WRITER_BLOCK_SIZE) writer_flush(w); break;
+	}
+}
+
+void writer_destroy(writer_t *w)
+{
+	writer_flush(w);
+	free(w->buf);
+	free(w);
+}
+
+const char *flush_policy_to_str(int flush_policy)
+{
+	switch (flush_policy) {
+		case FlushAlways: return "always";
+		case FlushOnIdle: return "on-idle";
+		case FlushNever: return "never";
+		default: return "unknown";
+	}
+}
+
+int flush_policy_from_str(const char *str)
+{
+	int i;
+	for (i = FlushPolicyStart; i <= FlushPolicyEnd; ++i) {
+		if (strcmp(str, flush_policy_to_str(i)) == 0) return i;
+	}
+	return -1;
+}
@@ -0,0 +1,60 @@
+#ifndef __WRITER_H
+#define __WRITER_H
+
+/* Builds the output in a buffer and writes it to a file descriptor in large blocks, without stdio.  When to write is
+ * chosen by the flush policy:
+ *   always  - after every record, so a wrapper waiting on each result is never kept waiting
+ *   on-idle - when no more input is buffered, so a wrapper sees each result before sending more, while a batch
+ *             writes in blocks
+ *   never   - only when the buffer is full, and at the end
+ */
+
+enum FlushPolicy {
+	FlushPolicyStart = 0,
+	FlushAlways      = 0,
+	FlushOnIdle      = 1,
+	FlushNever       = 2,
+	FlushPolicyEnd   = 2,
+};
+
+typedef struct {
+	int fd;
+	int flush_policy;
+	char *buf;
+	size_t n, m;
+} writer_t;
+
+writer_t *writer_init(int fd, int flush_policy);
+
+// Makes room for at least n more bytes
+void writer_reserve(writer_t *w, size_t n);
+
+// Writes all buffered output
+void writer_flush(writer_t *w);
+
+void writer_puts(writer_t *w, const char *s);
+
+// Appends n bytes, which need not end with a '\0'
+void writer_write(writer_t *w, const char *s, size_t n);
+
+void writer_put_int(writer_t *w, int32_t x);
+
+static inline void writer_putc(writer_t *w, char c)
+{
+	writer_reserve(w, 1);
+	w->buf[w->n++] = c;
+}
+
+// Writes the buffer if the flush policy says so, to be called after each record.  is_idle should be non-zero when no
+// more input is buffered, such that reading the next input may block.
+void writer_maybe_flush(writer_t *w, int is_idle);
+
+// Writes all buffered output, then frees the writer
+void writer_destroy(writer_t *w);
+
+const char *flush_policy_to_str(int flush_policy);
+
+// Returns -1 if the string is not a flush policy
+int flush_policy_from_str(const char *str);
+
+#endif
@@ -0,0 +1,142 @@
+/* The MIT License
+
+   Copyright (c) 201* by Nils Homer
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   "Software"), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+
+/* Aligns the pairs on standard input (alternating query and target lines) with libksw, as `ksw` would with the same
+ * options, splitting them between threads that each have their own context.  Used by tests/test.sh.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "ksw.h"
+
+#define N_THREADS 3
+
+typedef struct {
+	ksw_opt_t *opt;
+	int n;
+	const char **queries, **targets;
+	alignment_t *alignments;
+	int ret;
+	char err[KSW_ERR_LEN];
+} worker_t;
+
+static void *worker(void *data)
+{
+	worker_t *w = (worker_t*)data;
+	ksw_ctx_t *ctx = ksw_ctx_init(w->opt, w->err);
+	if (ctx == NULL) {
+		w->ret = -1;
+		return NULL;
+	}
+	w->ret = ksw_align_batch(ctx, w->n, w->queries, w->targets, w->alignments, w->err);
+	ksw_ctx_destroy(ctx);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	ksw_opt_t *opt = ksw_opt_init();
+	char err[KSW_ERR_LEN], *line = NULL;
+	size_t m_line = 0;
+	ssize_t l;
+	int c, i, j, n, n_seqs = 0, m = 0, ret = 0, add_cigar = 0;
+	char **seqs = NULL;
+	alignment_t *alignments;
+	pthread_t threads[N_THREADS];
+	worker_t workers[N_THREADS];
+
+	while ((c = getopt(argc, argv, "M:l:q:cI")) >= 0) {
+		if (c == '?') {
+			fprintf(stderr, "Usage: libksw [-M INT] [-l INT] [-q INT] [-c] [-I] < pairs.txt\n");
+			ksw_opt_destroy(opt);
+			return 1;
+		}
+		if (c == 'c') add_cigar = 1;
+		if (ksw_opt_set(opt, c, optarg, err) != 0) break;
+	}
+	if (c >= 0 || ksw_opt_prepare(opt, err) != 0) {
+		fprintf(stderr, "Error: %s\n", err);
+		ksw_opt_destroy(opt);
+		return 1;
+	}
+
+	while ((l = getline(&line, &m_line, stdin)) > 0) {
+		if (line[l-1] == '\n') line[--l] = '\0';
+		if (l == 0) break; // as for ksw
+		if (n_seqs == m) {
+			m = m ? m<<1 : 64;
+			seqs = realloc(seqs, m * sizeof(char*));
+		}
+		seqs[n_seqs++] = strdup(line);
+	}
+	free(line);
+	n = n_seqs / 2;
+	alignments = calloc(n, sizeof(alignment_t));
+
+	// each thread aligns a contiguous block of the pairs with its own context
+	for (i = 0; i < N_THREADS; ++i) {
+		int start = n * i / N_THREADS, end = n * (i + 1) / N_THREADS;
+		workers[i].opt = opt;
+		workers[i].n = end - start;
+		workers[i].queries = malloc((end - start + 1) * sizeof(char*));
+		workers[i].targets = malloc((end - start + 1) * sizeof(char*));
+		for (j = start; j < end; ++j) {
+			workers[i].queries[j - start] = seqs[2 * j];
+			workers[i].targets[j - start] = seqs[2 * j + 1];
+		}
+		workers[i].alignments = alignments + start;
+		pthread_create(&threads[i], NULL, worker, &workers[i]);
+	}
+	for (i = 0; i < N_THREADS; ++i) {
+		pthread_join(threads[i], NULL);
+		if (workers[i].ret != 0) {
+			fprintf(stderr, "Error: %s\n", workers[i].err);
+			ret = 1;
+		}
+		free(workers[i].queries);
+		free(workers[i].targets);
+	}
+
+	for (i = 0; ret == 0 && i < n; ++i) {
+		const alignment_t *a = &alignments[i];
+		printf("%d\t%d\t%d\t%d\t%d", a->score, a->qlb, a->qle, a->tlb, a->tle);
+		if (add_cigar) {
+			putchar('\t');
+			if (a->n_cigar == 0) putchar('*');
+			for (j = 0; j < a->n_cigar; ++j) printf("%d%c", a->cigar[j]>>4, "MID"[a->cigar[j]&0xf]);
+		}
+		putchar('\n');
+	}
+
+	for (i = 0; i < n; ++i) free(alignments[i].cigar);
+	free(alignments);
+	for (i = 0; i < n_seqs; ++i) free(seqs[i]);
+	free(seqs);
+	ksw_opt_destroy(opt);
+	return ret;
+}
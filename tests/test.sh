@@ -85,6 +85,454 @@ if [[ "$error_output" != *"Cannot open matrix file"* ]]; then
 fi
 echo "PASS: Missing matrix file error handling";
 
+# Test that batch mode (-t) produces the same output, in the same order, as interactive mode
+for args in "-M 0 -c -s" "-M 1 -c -O" "-l 1 -M 2 -c" "-l 1 -M 3 -c -s" "-l 2 -M 3 -c -H"
+do
+    echo "Testing batch mode with $args -t 4 -K 3";
+    if ! diff <($script_dir/../ksw $args < $script_dir/inputs.txt) <($script_dir/../ksw $args -t 4 -K 3 < $script_dir/inputs.txt); then
+        echo "FAIL: batch mode output differs for $args";
+        exit 1;
+    fi
+done
+echo "PASS: Batch mode output matches interactive mode";
+
+# Test that each parasail score width produces the same output as the 32-bit functions
+for args in "-M 0 -c" "-M 1 -c" "-M 3 -c" "-M 3"
+do
+    for score_width in 0 8 16
+    do
+        echo "Testing score width with $args -W $score_width";
+        if ! diff <($script_dir/../ksw $args -W 32 < $script_dir/inputs.txt) <($script_dir/../ksw $args -W $score_width < $script_dir/inputs.txt); then
+            echo "FAIL: score width $score_width output differs for $args";
+            exit 1;
+        fi
+    done
+done
+echo "PASS: Score widths match";
+
+# Test that one-vs-many input (-n) produces the same output as alternating queries and targets
+echo "Testing one-vs-many input (-n)";
+one_vs_many_expected=$(echo -e "GATTAC\nGATTAC\nGATTAC\nAAGATTACAA\nGATTAC\nGAT\nAAAA\nAAAAAAA" | $script_dir/../ksw -c);
+one_vs_many_actual=$(echo -e "GATTAC\n3\nGATTAC\nAAGATTACAA\nGAT\nCCC\n0\nAAAA\n1\nAAAAAAA" | $script_dir/../ksw -c -n);
+if [ "$one_vs_many_expected" != "$one_vs_many_actual" ]; then
+    echo "FAIL: one-vs-many output differs";
+    exit 1;
+fi
+echo "PASS: One-vs-many input";
+
+# Test that a two-piece affine gap model whose second piece is never cheaper matches the single affine gap model
+for alignment_mode in 2 3
+do
+    echo "Testing two-piece affine gaps with -l 1 -M $alignment_mode -c -Q 100 -E 2";
+    if ! diff <($script_dir/../ksw -l 1 -M $alignment_mode -c < $script_dir/inputs.txt) <($script_dir/../ksw -l 1 -M $alignment_mode -c -Q 100 -E 2 < $script_dir/inputs.txt); then
+        echo "FAIL: two-piece affine gap output differs for -M $alignment_mode";
+        exit 1;
+    fi
+done
+# a 30bp insertion and a 30bp deletion cost 65 each with one piece, so ungapped alignment with mismatches is better, but
+# only 40 each with a second piece (-Q 10 -E 1), which is then better
+two_piece_pair="AAAGCGGCACTTGTGAAGTGTTCCCCACGCGAAACGTGTTAACTGATTTATCCACCTTGTCGCTTGGGTCTTCTGTGTTGTTCGCGTGGT
+AAAGCGGCACTTGTGAAGTGTTCCCCACGCCGCTTGGGTCTTCTGTGTTGTTCGCGTGGTTAAAGTGAGCTGCTGTATCGTCGGCAAGGG";
+echo "Testing two-piece affine gaps with -l 1 -M 3 -c -Q 10 -E 1 on long gaps";
+if [ "$(echo "$two_piece_pair" | $script_dir/../ksw -l 1 -M 3 -c)" != "$(echo -e "-38\t0\t89\t0\t89\t90M")" ]; then
+    echo "FAIL: single affine gaps did not align the long gaps as mismatches";
+    exit 1;
+fi
+if [ "$(echo "$two_piece_pair" | $script_dir/../ksw -l 1 -M 3 -c -Q 10 -E 1)" != "$(echo -e "-20\t0\t89\t0\t89\t30M30I30M30D")" ]; then
+    echo "FAIL: two-piece affine gaps did not open the cheaper long gaps";
+    exit 1;
+fi
+echo "PASS: Two-piece affine gaps";
+
+# Test that finding the local and glocal start without a traceback (-S) agrees with the start from the cigar
+for alignment_mode in 0 1
+do
+    echo "Testing finding the start without the cigar (-S) with -M $alignment_mode";
+    if ! diff <($script_dir/../ksw -M $alignment_mode -c < $script_dir/inputs.txt | cut -f 1-5) <($script_dir/../ksw -M $alignment_mode -S < $script_dir/inputs.txt); then
+        echo "FAIL: starts differ with -S for -M $alignment_mode";
+        exit 1;
+    fi
+done
+echo "PASS: Finding the local and glocal start without the cigar";
+
+# Test the result cache (--cache): repeated pairs are served from the cache with the same output, and a second run
+# restores the saved cache (--cache-file) so every pair is a hit
+echo "Testing the result cache (--cache)";
+cache_input=$(mktemp);
+cache_fn=$(mktemp -u);
+cat $script_dir/inputs.txt $script_dir/inputs.txt > $cache_input;
+for cache_args in "-c -s" "-M 3 -c -t 2 -K 3" "-S --strand both"
+do
+    cache_expected=$($script_dir/../ksw $cache_args < $cache_input);
+    if [ "$cache_expected" != "$($script_dir/../ksw $cache_args --cache 1 < $cache_input)" ]; then
+        echo "FAIL: output differs with the cache and '$cache_args'";
+        exit 1;
+    fi
+    for cache_run in 1 2
+    do
+        if [ "$cache_expected" != "$($script_dir/../ksw $cache_args --cache 1 --cache-file $cache_fn < $cache_input)" ]; then
+            echo "FAIL: output differs with the cache saved to a file, run $cache_run, and '$cache_args'";
+            exit 1;
+        fi
+    done
+    if $script_dir/../ksw $cache_args --cache 1 --cache-file $cache_fn -v < $cache_input 2>&1 > /dev/null | grep -q '^\[cache\] .* [1-9][0-9]* misses'; then
+        echo "FAIL: pairs were not restored from the cache file with '$cache_args'";
+        exit 1;
+    fi
+    rm -f $cache_fn;
+done
+rm -f $cache_input;
+echo "PASS: Result cache";
+
+# Test reading pairs from a file (-i): mapped, or read through a pipe, the output matches standard input
+echo "Testing reading pairs from a file (-i)";
+for input_args in "-c -s" "-t 2 -K 3 -c" "-I -t 2"
+do
+    input_expected=$($script_dir/../ksw $input_args < $script_dir/inputs.txt);
+    if [ "$input_expected" != "$($script_dir/../ksw $input_args -i $script_dir/inputs.txt)" ]; then
+        echo "FAIL: output differs reading a mapped file with '$input_args'";
+        exit 1;
+    fi
+    if [ "$input_expected" != "$(cat $script_dir/inputs.txt | $script_dir/../ksw $input_args -i /dev/stdin)" ]; then
+        echo "FAIL: output differs reading a pipe with '$input_args'";
+        exit 1;
+    fi
+done
+# a query and target split by a space or tab, and commands ending with "\r\n", are split as on standard input
+split_input=$(mktemp);
+printf "GATTAC GATTTAC\n#set -q 0 -r 1\r\nGATTAC\tGATTTAC\n#set\nGATTAC\nAAGATTACAA\r\n" > $split_input;
+for input_args in "-c" "-t 2 -K 3 -c"
+do
+    if [ "$($script_dir/../ksw $input_args < $split_input)" != "$($script_dir/../ksw $input_args -i $split_input)" ]; then
+        echo "FAIL: output differs reading a mapped file with spaces, tabs, and \\r\\n with '$input_args'";
+        exit 1;
+    fi
+done
+rm -f $split_input;
+echo "PASS: Reading pairs from a file";
+
+# Test skipping the DP for pairs that provably align best without gaps: identical pairs, and pairs with a substitution in
+# the middle, match the DP, which z-drop (-z) always runs for global
+echo "Testing the ungapped fast path";
+ungapped_input=$(awk 'NR % 2 == 1 && length($0) > 0 { print; print; print; m = int(length($0) / 2) + 1; b = substr($0, m, 1) == "A" ? "C" : "A"; print substr($0, 1, m - 1) b substr($0, m + 1) }' $script_dir/inputs.txt);
+for ungapped_args in "-M 3 -c" "-M 3 -S" "-l 1 -M 3 -c"
+do
+    if ! diff <(echo "$ungapped_input" | $script_dir/../ksw $ungapped_args) <(echo "$ungapped_input" | $script_dir/../ksw $ungapped_args -z 100000); then
+        echo "FAIL: the ungapped fast path differs from the DP with '$ungapped_args'";
+        exit 1;
+    fi
+done
+echo "PASS: Ungapped fast path";
+
+# Test the statistics report (--stats): the output is unchanged, and one alignment is counted per pair in each thread mode
+echo "Testing the statistics report (--stats)";
+stats_n_pairs=$(( $(wc -l < $script_dir/inputs.txt) / 2 ));
+for stats_args in "" "-t 2 -K 7" "-t 2 -I"
+do
+    if ! diff <($script_dir/../ksw -c $stats_args < $script_dir/inputs.txt) <($script_dir/../ksw -c $stats_args --stats tsv < $script_dir/inputs.txt 2> /dev/null); then
+        echo "FAIL: output differs with --stats and '$stats_args'";
+        exit 1;
+    fi
+    stats_alignments=$($script_dir/../ksw -c $stats_args --stats tsv < $script_dir/inputs.txt 2>&1 > /dev/null | awk '$1 == "alignments" { print $2 }');
+    if [ "$stats_alignments" != "$stats_n_pairs" ]; then
+        echo "FAIL: counted $stats_alignments alignments rather than $stats_n_pairs with '$stats_args'";
+        exit 1;
+    fi
+done
+stats_json=$($script_dir/../ksw --stats json < $script_dir/inputs.txt 2>&1 > /dev/null);
+if ! echo "$stats_json" | grep -q '"kernel_cells": {'; then
+    echo "FAIL: no kernel cells in the JSON report";
+    exit 1;
+fi
+echo "PASS: Statistics report";
+
+# Test aligning both strands (--strand): the reverse strand matches aligning to the reverse-complemented target
+echo "Testing aligning both strands (--strand)";
+strand_targets=$(awk 'NR % 2 == 0' $script_dir/inputs.txt | rev | tr ACGTacgt TGCAtgca);
+strand_rev_input=$(paste -d '\n' <(awk 'NR % 2 == 1' $script_dir/inputs.txt) <(echo "$strand_targets"));
+strand_forward=$($script_dir/../ksw -M 1 -c < $script_dir/inputs.txt | awk 'BEGIN { OFS = "\t" } { $6 = "+\t" $6; print }');
+strand_reverse=$(echo "$strand_rev_input" | $script_dir/../ksw -M 1 -c | awk 'BEGIN { OFS = "\t" } { $6 = "-\t" $6; print }');
+strand_expected=$(paste -d '\n' <(echo "$strand_forward") <(echo "$strand_reverse"));
+for strand_args in "" "-t 2 -K 3"
+do
+    if [ "$strand_expected" != "$($script_dir/../ksw -M 1 -c --strand both $strand_args < $script_dir/inputs.txt)" ]; then
+        echo "FAIL: both strands differ from aligning to the reverse complement with '$strand_args'";
+        exit 1;
+    fi
+done
+strand_best=$(echo "$strand_expected" | awk -F '\t' 'NR % 2 == 1 { best = $0; score = $1 } NR % 2 == 0 { if ($1 > score) best = $0; print best }');
+if [ "$strand_best" != "$($script_dir/../ksw -M 1 -c --strand best < $script_dir/inputs.txt)" ]; then
+    echo "FAIL: the best strand differs";
+    exit 1;
+fi
+echo "PASS: Aligning both strands";
+
+# Test switching the scoring in-band (#set): each pair matches ksw started with the options in effect for it
+echo "Testing switching the scoring in-band (#set)";
+scheme_input="GATTAC\nGATTTAC\n#set -q 0 -r 1\nGATTAC\nGATTTAC\n#set -M 1 -a 2\nGATTAC\nAAGATTACAA\n#set\nGATTAC\nGATTTAC\n";
+scheme_expected=$( (printf "GATTAC\nGATTTAC\n" | $script_dir/../ksw -M 3 -c; printf "GATTAC\nGATTTAC\n" | $script_dir/../ksw -M 3 -c -q 0 -r 1; printf "GATTAC\nAAGATTACAA\n" | $script_dir/../ksw -M 1 -a 2 -c; printf "GATTAC\nGATTTAC\n" | $script_dir/../ksw -M 3 -c) );
+for scheme_args in "" "-t 2 -K 1"
+do
+    scheme_actual=$(printf "$scheme_input" | $script_dir/../ksw -M 3 -c $scheme_args);
+    if [ "$scheme_expected" != "$scheme_actual" ]; then
+        echo "FAIL: output differs after switching the scoring in-band with '$scheme_args'";
+        exit 1;
+    fi
+done
+# a malformed command is reported, and the scoring in effect is kept
+scheme_bad_input="GATTAC\nGATTTAC\n#set -q 0 -r 1\nGATTAC\nGATTTAC\n#set -q\nGATTAC\nGATTTAC\n#set -x 1\nGATTAC\nGATTTAC\n";
+scheme_bad_expected=$( (printf "GATTAC\nGATTTAC\n" | $script_dir/../ksw -M 3 -c; printf "GATTAC\nGATTTAC\nGATTAC\nGATTTAC\nGATTAC\nGATTTAC\n" | $script_dir/../ksw -M 3 -c -q 0 -r 1) );
+for scheme_args in "" "-t 2 -K 1"
+do
+    if ! scheme_actual=$(printf "$scheme_bad_input" | $script_dir/../ksw -M 3 -c $scheme_args 2> /dev/null); then
+        echo "FAIL: a malformed command ended the run with '$scheme_args'";
+        exit 1;
+    fi
+    if [ "$scheme_bad_expected" != "$scheme_actual" ]; then
+        echo "FAIL: output differs after a malformed command with '$scheme_args'";
+        exit 1;
+    fi
+    if [ "$(printf "$scheme_bad_input" | $script_dir/../ksw -M 3 -c $scheme_args 2>&1 > /dev/null | grep -c "^Error: ")" != "2" ]; then
+        echo "FAIL: a malformed command was not reported with '$scheme_args'";
+        exit 1;
+    fi
+done
+echo "PASS: Switching the scoring in-band";
+
+# Test the binary framed protocol (-B): one frame (request 7, GATTAC vs GATTAC) in, one record out
+echo "Testing the binary framed protocol (-B)";
+binary_expected=$(printf '\x24\x00\x00\x00\x07\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x06\x00\x00\x00\xff\xff\xff\xff\x05\x00\x00\x00\xff\xff\xff\xff\x05\x00\x00\x00\x00\x00\x00\x00' | od -An -tx1);
+binary_actual=$(printf '\x20\x00\x00\x00\x07\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x06\x00\x00\x00\x06\x00\x00\x00GATTACGATTAC' | $script_dir/../ksw -B | od -An -tx1);
+if [ "$binary_expected" != "$binary_actual" ]; then
+    echo "FAIL: binary protocol output differs";
+    exit 1;
+fi
+# a frame whose query length (0xFFFFFFFF) wraps the 32-bit sum of the lengths, and a frame longer than the maximum, are
+# rejected rather than crashing
+for binary_malformed in '\x18\x00\x00\x00\x07\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff\xff\xff\x05\x00\x00\x00ACGT' '\xff\xff\xff\xff'
+do
+    binary_status=0;
+    printf "$binary_malformed" | $script_dir/../ksw -B > /dev/null 2>&1 || binary_status=$?;
+    if [ "$binary_status" != "1" ]; then
+        echo "FAIL: a malformed frame exited with $binary_status rather than being rejected";
+        exit 1;
+    fi
+done
+echo "PASS: Binary framed protocol";
+
+# Test serving clients over a Unix domain socket (--listen): each connection matches the binary protocol (-B) on the
+# same frames, including params set for that connection only (request 8, then GATTAC vs GATTTAC as request 9)
+if command -v python3 > /dev/null; then
+    echo "Testing the server (--listen)";
+    listen_dir=$(mktemp -d);
+    listen_params='\x24\x00\x00\x00\x08\x00\x00\x00\x00\x00\x00\x00\x03\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x01\x00\x00\x00\xff\xff\xff\xff\xff\xff\xff\xff';
+    listen_frame='\x21\x00\x00\x00\x09\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x06\x00\x00\x00\x07\x00\x00\x00GATTACGATTTAC';
+    listen_client='import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(sys.stdin.buffer.read())
+s.shutdown(socket.SHUT_WR)
+while True:
+    data = s.recv(65536)
+    if not data: break
+    sys.stdout.buffer.write(data)';
+    $script_dir/../ksw -M 3 -c -t 2 --listen $listen_dir/ksw.sock &
+    listen_pid=$!;
+    for i in $(seq 1 50); do if [ -S $listen_dir/ksw.sock ]; then break; fi; sleep 0.1; done
+    for listen_input in "$listen_params$listen_frame" "$listen_frame"
+    do
+        listen_expected=$(printf "$listen_input" | $script_dir/../ksw -M 3 -c -B | od -An -tx1);
+        listen_actual=$(printf "$listen_input" | python3 -c "$listen_client" $listen_dir/ksw.sock | od -An -tx1);
+        if [ -z "$listen_expected" ] || [ "$listen_expected" != "$listen_actual" ]; then
+            echo "FAIL: server output differs from the binary protocol";
+            kill $listen_pid;
+            rm -r $listen_dir;
+            exit 1;
+        fi
+    done
+    # a client sending a malformed frame (a query length that wraps around, or a frame longer than the maximum) is closed
+    # without a record, and the server still answers the next client
+    for listen_malformed in '\x18\x00\x00\x00\x07\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff\xff\xff\x05\x00\x00\x00ACGT' '\xff\xff\xff\xf0\x07\x00\x00\x00'
+    do
+        listen_actual=$(printf "$listen_malformed" | python3 -c "$listen_client" $listen_dir/ksw.sock 2> /dev/null | od -An -tx1);
+        listen_expected=$(printf "$listen_frame" | $script_dir/../ksw -M 3 -c -B | od -An -tx1);
+        if [ -n "$listen_actual" ] || [ "$listen_expected" != "$(printf "$listen_frame" | python3 -c "$listen_client" $listen_dir/ksw.sock | od -An -tx1)" ]; then
+            echo "FAIL: the server did not close a connection with a malformed frame, and keep serving others";
+            kill $listen_pid;
+            rm -r $listen_dir;
+            exit 1;
+        fi
+    done
+    kill $listen_pid;
+    wait $listen_pid || true;
+    if [ -e $listen_dir/ksw.sock ]; then
+        echo "FAIL: the server did not remove the socket";
+        rm -r $listen_dir;
+        exit 1;
+    fi
+    rm -r $listen_dir;
+    echo "PASS: Server";
+fi
+
+# Test that reading FASTA/FASTQ files (interleaved, gzip-compressed, or paired) matches reading standard input
+echo "Testing FASTA/FASTQ input";
+fastx_dir=$(mktemp -d);
+echo -e ">q1 first query\nGATTAC\n>t1\nAAGATTACAA\n>q2\nAAAA\n>t2\nAAAAAAA" > $fastx_dir/interleaved.fa;
+gzip -c $fastx_dir/interleaved.fa > $fastx_dir/interleaved.fa.gz;
+echo -e "@q1\nGATTAC\n+\nIIIIII\n@q2\nAAAA\n+\nIIII" > $fastx_dir/queries.fq;
+echo -e ">t1\nAAGATTACAA\n>t2\nAAAAAAA" > $fastx_dir/targets.fa;
+fastx_expected=$(echo -e "GATTAC\nAAGATTACAA\nAAAA\nAAAAAAA" | $script_dir/../ksw -c | sed -e 's_^_q1\tt1\t_' -e '2s_^q1\tt1_q2\tt2_');
+for fastx_args in "interleaved.fa" "interleaved.fa.gz" "queries.fq $fastx_dir/targets.fa"
+do
+    fastx_actual=$($script_dir/../ksw -c $fastx_dir/$fastx_args);
+    if [ "$fastx_expected" != "$fastx_actual" ]; then
+        echo "FAIL: FASTA/FASTQ output differs for $fastx_args";
+        rm -r $fastx_dir;
+        exit 1;
+    fi
+done
+rm -r $fastx_dir;
+echo "PASS: FASTA/FASTQ input";
+
+# Test that the benchmark runs every valid combination: ksw2 has two modes, parasail three modes and three strategies
+echo "Testing the benchmark (bench)";
+bench_rows=$($script_dir/../ksw bench -N 10 -L 50 | tail -n +2 | wc -l);
+if [ "$bench_rows" -ne 22 ]; then
+    echo "FAIL: expected 22 benchmark rows, found $bench_rows";
+    exit 1;
+fi
+echo "PASS: Benchmark";
+
+# Test that the flush policy (-F) does not change the output
+for flush_policy in always on-idle never
+do
+    echo "Testing the flush policy -F $flush_policy";
+    if ! diff <($script_dir/../ksw -c -s < $script_dir/inputs.txt) <($script_dir/../ksw -c -s -F $flush_policy < $script_dir/inputs.txt); then
+        echo "FAIL: output differs with -F $flush_policy";
+        exit 1;
+    fi
+done
+echo "PASS: Flush policy";
+
+# Test that a minimum score (-T) only drops pairs (-D) below it, and keeps the rest unchanged
+for alignment_mode in 0 1 2 3
+do
+    echo "Testing the minimum score with -M $alignment_mode -c -T 2 -D";
+    if ! diff <($script_dir/../ksw -M $alignment_mode -c < $script_dir/inputs.txt | awk '$1 >= 2') <($script_dir/../ksw -M $alignment_mode -c -T 2 -D < $script_dir/inputs.txt); then
+        echo "FAIL: output differs with a minimum score for -M $alignment_mode";
+        exit 1;
+    fi
+    # without -D, every pair is output with the same score, and only those below the minimum have no cigar ('*')
+    echo "Testing the minimum score with -M $alignment_mode -c -T 2";
+    if ! diff <($script_dir/../ksw -M $alignment_mode -c < $script_dir/inputs.txt | awk '$1 >= 2') <($script_dir/../ksw -M $alignment_mode -c -T 2 < $script_dir/inputs.txt | awk '$1 >= 2'); then
+        echo "FAIL: output of pairs reaching the minimum score differs for -M $alignment_mode";
+        exit 1;
+    fi
+    if ! diff <($script_dir/../ksw -M $alignment_mode -c < $script_dir/inputs.txt | cut -f 1) <($script_dir/../ksw -M $alignment_mode -c -T 2 < $script_dir/inputs.txt | cut -f 1); then
+        echo "FAIL: scores differ with a minimum score for -M $alignment_mode";
+        exit 1;
+    fi
+    if [ -n "$($script_dir/../ksw -M $alignment_mode -c -T 2 < $script_dir/inputs.txt | awk '$1 < 2 && $6 != "*"')" ]; then
+        echo "FAIL: pairs below the minimum score have a cigar for -M $alignment_mode";
+        exit 1;
+    fi
+done
+echo "PASS: Minimum score";
+
+# Test that the inter-sequence engine (-I) produces the same output as aligning one pair at a time
+for alignment_mode in 0 1 3
+do
+    for gap_open in 5 0
+    do
+        echo "Testing the inter-sequence engine with -l 2 -M $alignment_mode -q $gap_open -I";
+        if ! diff <($script_dir/../ksw -l 2 -M $alignment_mode -q $gap_open < $script_dir/inputs.txt) <($script_dir/../ksw -l 2 -M $alignment_mode -q $gap_open -I -K 5 < $script_dir/inputs.txt); then
+            echo "FAIL: inter-sequence output differs for -M $alignment_mode -q $gap_open";
+            exit 1;
+        fi
+    done
+done
+echo "PASS: Inter-sequence engine";
+
+# Test that a band wide enough to hold every pair does not change global alignment with parasail
+for band_width in 1000 -1
+do
+    echo "Testing a banded global alignment with -l 2 -M 3 -w $band_width";
+    if ! diff <($script_dir/../ksw -l 2 -M 3 < $script_dir/inputs.txt) <($script_dir/../ksw -l 2 -M 3 -w $band_width < $script_dir/inputs.txt); then
+        echo "FAIL: banded global output differs for -w $band_width";
+        exit 1;
+    fi
+    # the cigar for a banded alignment is found with ksw2
+    if ! diff <($script_dir/../ksw -l 1 -M 3 -c -w $band_width < $script_dir/inputs.txt) <($script_dir/../ksw -l 2 -M 3 -c -w $band_width < $script_dir/inputs.txt); then
+        echo "FAIL: banded global output with the cigar differs for -w $band_width";
+        exit 1;
+    fi
+done
+# a band narrower than the difference in lengths is widened to reach the end of both sequences, so the score and ends are
+# the same with the cigar (ksw2) as without (parasail)
+for band_width in 0 2
+do
+    echo "Testing a narrow banded global alignment with -l 2 -M 3 -w $band_width";
+    if ! diff <($script_dir/../ksw -l 2 -M 3 -w $band_width < $script_dir/inputs.txt | cut -f 1,3,5) <($script_dir/../ksw -l 2 -M 3 -c -w $band_width < $script_dir/inputs.txt | cut -f 1,3,5); then
+        echo "FAIL: narrow banded global output differs with the cigar for -w $band_width";
+        exit 1;
+    fi
+done
+echo "PASS: Banded global alignment";
+
+# Test that choosing the library for each pair (-l 3), calibrated or from a cost model (-P), does not change the output
+per_pair_model=$(mktemp);
+echo -e "#max_length\tlibrary\tvec_strategy\n7\tparasail\tscan\n12\tksw2\t-\n24\tparasail\tdiag\n28\tparasail\tstriped" > $per_pair_model;
+for per_pair_args in "-M 0" "-M 1" "-M 2 -c" "-M 3" "-M 3 -P $per_pair_model"
+do
+    echo "Testing the per-pair library with $per_pair_args";
+    if ! diff <($script_dir/../ksw ${per_pair_args% -P*} < $script_dir/inputs.txt) <($script_dir/../ksw -l 3 $per_pair_args < $script_dir/inputs.txt); then
+        echo "FAIL: per-pair library output differs for $per_pair_args";
+        rm $per_pair_model;
+        exit 1;
+    fi
+done
+# with the cigar, a global alignment only chooses between parasail's strategies, so the cigar does not depend on the model
+for per_pair_choice in "parasail\tstriped" "parasail\tscan" "parasail\tdiag"
+do
+    echo "Testing the per-pair library with -M 3 -c and a model of $per_pair_choice";
+    echo -e "1000\t$per_pair_choice" > $per_pair_model;
+    if ! diff <($script_dir/../ksw -M 3 -c < $script_dir/inputs.txt) <($script_dir/../ksw -l 3 -M 3 -c -P $per_pair_model < $script_dir/inputs.txt); then
+        echo "FAIL: per-pair library output differs for -M 3 -c and a model of $per_pair_choice";
+        rm $per_pair_model;
+        exit 1;
+    fi
+done
+echo -e "1000\tksw2\t-" > $per_pair_model;
+if $script_dir/../ksw -l 3 -M 3 -c -P $per_pair_model < $script_dir/inputs.txt > /dev/null 2>&1; then
+    echo "FAIL: a model choosing ksw2 for a global cigar was accepted";
+    rm $per_pair_model;
+    exit 1;
+fi
+rm $per_pair_model;
+echo "PASS: Per-pair library";
+
+# Test that aligning with libksw, from more than one thread, matches ksw (tests/libksw is built by `make test`)
+for libksw_args in "-M 0 -c" "-M 1" "-M 2 -c" "-M 3 -c" "-l 2 -M 0 -I"
+do
+    echo "Testing libksw with $libksw_args";
+    if ! diff <($script_dir/../ksw $libksw_args < $script_dir/inputs.txt) <($script_dir/libksw $libksw_args < $script_dir/inputs.txt); then
+        echo "FAIL: libksw output differs for $libksw_args";
+        exit 1;
+    fi
+done
+# invalid options are returned as an error, rather than exiting in the library
+libksw_error=$($script_dir/libksw -l 1 -M 0 < $script_dir/inputs.txt 2>&1 || true);
+if [[ "$libksw_error" != *"Cannot use alignment mode"* ]]; then
+    echo "FAIL: libksw did not return the error for invalid options: $libksw_error";
+    exit 1;
+fi
+libksw_error=$($script_dir/libksw -q x < $script_dir/inputs.txt 2>&1 || true);
+if [[ "$libksw_error" != *"Expected an integer for -q"* ]]; then
+    echo "FAIL: libksw did not return the error for a malformed option: $libksw_error";
+    exit 1;
+fi
+echo "PASS: libksw";
+
 # Check test output
 if [ "$overwrite" == "0" ]; then
     diff $actual $expected;